@@ -7,6 +7,7 @@
  * Refactoring by Chengyu HAN, 2022/10/22
  * Revised version, September 2007
  */
+#define _GNU_SOURCE // pthread_setaffinity_np, sched_getcpu
 #include <math.h>
 #include <stdio.h>
 #include <string.h> // strlen
@@ -14,13 +15,45 @@
 #include <stdlib.h> // srand48, drand48
 #include <time.h>
 #include <limits.h> // UCHAR_MAX, USHRT_MAX
+#include <stdint.h> // uintptr_t
+#include <errno.h>
+#include <unistd.h> // dup, dup2
+#include <fcntl.h>
+#include <sys/select.h>
+#include <pthread.h>
+#include <sched.h> // cpu_set_t
+#include <sys/mman.h> // madvise
+#include <stdatomic.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/resource.h>
 
 
 #define NR_MAX 1002
-#define NC_MAX 1002
+/** the rows are padded to a multiple of 8 cells, see HEX_INDEX() */
+#define NC_MAX 1008
+
+/**
+ * The fields are stored row by row, cell (i, j) at the linear index
+ * HEX_INDEX(i, j) of &field[0][0], so the six neighbours of a cell are
+ * at the same offsets everywhere. With NC_MAX a multiple of 8 and the
+ * fields aligned to 64 bytes every row starts on a 64 byte boundary.
+ */
+#define HEX_INDEX(i, j) ((i) * NC_MAX + (j))
+#define HEX_DOWN NC_MAX             /* (i + 1, j) */
+#define HEX_UP (-NC_MAX)            /* (i - 1, j) */
+#define HEX_LEFT (-1)               /* (i, j - 1) */
+#define HEX_RIGHT 1                 /* (i, j + 1) */
+#define HEX_UP_RIGHT (1 - NC_MAX)   /* (i - 1, j + 1) */
+#define HEX_DOWN_LEFT (NC_MAX - 1)  /* (i + 1, j - 1) */
 
 #define KAPPA_MAX 64
 
@@ -81,16 +114,68 @@ int g_center_i, g_center_j;
 int g_r_old, g_r_new;
 
 /** diffusion field */
-double  d_dif[NR_MAX][NC_MAX];
+double  d_dif[NR_MAX][NC_MAX] __attribute__((aligned(64)));
 /** indicator of snowflake sites */
-int     a_pic[NR_MAX][NC_MAX];
+int     a_pic[NR_MAX][NC_MAX] __attribute__((aligned(64)));
 /** boundary mass */
-double  b__fr[NR_MAX][NC_MAX];
+double  b__fr[NR_MAX][NC_MAX] __attribute__((aligned(64)));
 /** crystal mass */
-double  c__lm[NR_MAX][NC_MAX];
+double  c__lm[NR_MAX][NC_MAX] __attribute__((aligned(64)));
 
 /** rings pallette */
-int     ash[NR_MAX][NC_MAX];
+int     ash[NR_MAX][NC_MAX] __attribute__((aligned(64)));
+
+// ---- mass, see mass_weight()
+/** vapor, boundary and crystal mass, kept up to date by the phases */
+double g_mass_vapor, g_mass_boundary, g_mass_crystal;
+/** recount the mass every this many steps, 0: never */
+int g_mass_audit_every;
+/** crystal cells, and the boundary cells freezing saw, weighted as the mass */
+long g_attached, g_frontier;
+
+// ---- observables, see obs_check()
+char g_obs_path[MAX_IO_PATH_LEN];
+FILE *g_obs_file;
+int g_obs_every = 10;
+int g_obs_last_pq, g_obs_last_r;
+
+// ---- termination, see stop_check()
+#define STOP_NONE     0
+#define STOP_RADIUS   1
+#define STOP_STEPS    2
+#define STOP_TARGET   3
+#define STOP_IDLE     4
+#define STOP_VAPOR    5
+#define STOP_MASS     6
+#define STOP_SECONDS  7
+#define STOP_GOLDEN   8
+
+const char *stop_NAMES[] = {"none", "radius", "steps", "target-radius", "idle", "vapor", "mass", "seconds", "golden"};
+
+/** why g_stop was set */
+int g_stop_reason;
+int g_stop_reported;
+/** largest change of a vapor cell by the last diffusion */
+double g_vapor_change;
+int g_stop_radius;
+int g_stop_idle;
+double g_stop_vapor;
+double g_stop_mass;
+int g_stop_window = 100;
+double g_stop_seconds;
+long long g_stop_t0;
+long g_stop_attached;
+int g_stop_attach_pq;
+int g_stop_start_pq;
+double g_stop_frac[3];
+
+// ---- temporally tiled diffusion, see tile_begin()
+#define TILE_STEPS_MAX 64
+/** -tile-steps, -tile-rows */
+int g_tile_steps;
+int g_tile_rows = 32;
+/** the open block: its steps, the steps done, the last near row */
+int g_tile_T, g_tile_done, g_tile_N;
 
 // ---- other global var
 int g_noac;
@@ -111,6 +196,11 @@ int g_xScreen;
 unsigned long g_xBlack, g_xWhite;
 // main while loop control flag.
 int g_exit_flag;
+// framebuffer of the cells, sent with one (Shm)PutImage per frame
+XImage *g_xImage;
+XShmSegmentInfo g_xShmInfo;
+int g_xUseShm;
+int g_xShmError;
 
 // x11 windows in args
 const char gui_ICON_NAME_STR[] = "sn";
@@ -118,6 +208,16 @@ const char gui_WINDOW_NAME_STR[] = "digital snowflake";
 const char gui_TIME_STR[] = "time:";
 const char gui_ACTIVE_STR[] = "active area:";
 
+// ---- colors of g_othp[], rgb as in the X color database: orange,
+// gray90, gray80, gray70, gray60, gray50, gray40, gray30, gray25, gray20,
+// black, azure, lightblue2, lightblue3, lightblue4, cornflowerblue, white,
+// palegreen, red
+const unsigned char gui_OTHP_RGB[19][3] = {
+    {255, 165, 0}, {229, 229, 229}, {204, 204, 204}, {179, 179, 179}, {153, 153, 153},
+    {127, 127, 127}, {102, 102, 102}, {77, 77, 77}, {64, 64, 64}, {51, 51, 51},
+    {0, 0, 0}, {240, 255, 255}, {178, 223, 238}, {154, 192, 205}, {104, 131, 139},
+    {100, 149, 237}, {255, 255, 255}, {152, 251, 152}, {255, 0, 0}};
+
 // ---- color map
 Colormap g_cmap;
 XColor g_color[KAPPA_MAX];
@@ -127,6 +227,256 @@ XColor g_othp[20];
 // temp color array
 int g_red[125], g_green[125], g_blue[125];
 
+/* ==== Rendering ==== */
+/** the fields a picture is colored from */
+typedef struct
+{
+    int (*a_pic)[NC_MAX];
+    double (*d_dif)[NC_MAX];
+    double (*c__lm)[NC_MAX];
+    int (*ash)[NC_MAX];
+} render_src;
+
+/** palette constants of a frame, see render_row() */
+typedef struct
+{
+    double rho;
+    double on_lo, on_range;
+    double t50, t70;
+} render_lut;
+
+/** the live simulation state */
+render_src g_live = {a_pic, d_dif, c__lm, ash};
+/** color of each rendered cell, see render_wedge() */
+XColor *g_cell_color[NR_MAX][NC_MAX];
+/** rgb rows of the upper half of the saved picture */
+unsigned char g_img_rows[NR_MAX][3 * 2 * NC_MAX];
+
+// ---- command line
+/** run without X11 window, see run_headless() */
+bool g_headless;
+/** stop after this many steps, 0: until g_stop */
+int g_max_steps;
+/** seed of the random numbers, -1: from the clock */
+int g_seed = -1;
+
+// ---- golden trajectory, see golden_start()
+#define GOLDEN_RECORD 1
+#define GOLDEN_CHECK  2
+#define GOLDEN_FIELDS 5
+#define GOLDEN_SUMS   1
+#define GOLDEN_KEY    2
+
+const char *golden_NAMES[GOLDEN_FIELDS] = {"d_dif", "a_pic", "b__fr", "c__lm", "ash"};
+
+typedef struct
+{
+    char magic[8];
+    int nr, nc, seed, h, twelve, every;
+    double par[9];
+} golden_header;
+
+int g_golden;
+char g_golden_path[MAX_IO_PATH_LEN];
+FILE *g_golden_file;
+/** a keyframe (the whole state) every this many steps */
+int g_golden_every = 250;
+/** tolerated difference per field, compare keyframes only */
+double g_golden_tol[GOLDEN_FIELDS];
+int g_golden_tolerant;
+/** first step whose checksums differ, -1: none */
+int g_golden_diverged = -1;
+int g_golden_failed;
+/** last step compared with the reference */
+int g_golden_last;
+/** tag and step of the next record of the reference */
+int g_golden_tag, g_golden_step;
+
+// ---- ensemble runs, see run_ensemble()
+/** -ensemble: the parameter sets */
+char g_ens_path[MAX_IO_PATH_LEN];
+/** -ensemble-threads, -ensemble-journal, -ensemble-progress (seconds) */
+int g_ens_threads = 1;
+char g_ens_journal_path[MAX_IO_PATH_LEN];
+double g_ens_progress = 10.0;
+
+// ---- kernel benchmark, see run_bench()
+/** -bench: results are written to this file */
+char g_bench_path[MAX_IO_PATH_LEN];
+char g_bench_sizes[MAX_IO_PATH_LEN] = "100,250,500,1000,4000";
+/** time each kernel for at least this long per state */
+int g_bench_ms = 200;
+/** steps of the dynamics that make the "grown" state */
+int g_bench_steps = 200;
+
+// ---- time-lapse frames, see io_frames_start()
+#define FRAMES_RING 4
+#define FRAMES_MAX_WORKERS 8
+
+/** an immutable copy of the fields a picture is colored from */
+typedef struct
+{
+    int number;
+    int pq;
+    int r_new;
+    render_src src;
+} snapshot;
+
+typedef struct
+{
+    pthread_t thread;
+    snapshot ring[FRAMES_RING];
+    /** pushed (by the simulation) / written (by the worker) frames */
+    atomic_uint tail, head;
+    XColor *(*cells)[NC_MAX];
+    unsigned char (*rows)[3 * 2 * NC_MAX];
+} frames_worker;
+
+int g_frames_every;
+int g_frames_every_r;
+int g_frames_workers = 1;
+int g_frames_rings;
+char g_frames_path[MAX_IO_PATH_LEN];
+FILE *g_frames_stream;
+frames_worker *g_frames_w;
+int g_frames_count;
+int g_frames_last_r;
+long g_frames_stalls;
+atomic_int g_frames_done;
+
+// ---- simulation thread of the viewer, see sim_thread()
+#define SIM_PLAY    1
+#define SIM_PAUSE   2
+#define SIM_STEP    3
+#define SIM_SAVE    4
+#define SIM_READ    5
+#define SIM_QUIT    6
+/** run `arg` steps, grow the radius by `arg` */
+#define SIM_RUN     7
+#define SIM_GROW    8
+#define SIM_CMD_RING 16
+/** a batch of steps of [play] and the runs takes about this long */
+#define SIM_BATCH_MS 10
+/** flag of `g_snap_ready`: published, not yet taken by the viewer */
+#define SNAP_FRESH  4
+
+pthread_t g_sim_thread;
+/** buttons pressed in the viewer, read by the simulation */
+int g_sim_cmds[SIM_CMD_RING];
+int g_sim_args[SIM_CMD_RING];
+atomic_uint g_sim_cmd_head, g_sim_cmd_tail;
+/** triple buffer: written by the simulation, shown by the viewer, and ready */
+snapshot g_snap[3];
+int g_snap_back, g_snap_front;
+atomic_int g_snap_ready;
+/** [pause] was pressed, see gui_picture_shown() */
+int g_gui_rings;
+/** colors of the shown snapshot */
+XColor *g_gui_cells[NR_MAX][NC_MAX];
+
+// ---- incremental redraw, see gui_draw_cells()
+#define GUI_TILE 16
+/** colors in the framebuffer */
+XColor *g_gui_drawn[NR_MAX][NC_MAX];
+/** tiles of GUI_TILE x GUI_TILE cells changed since the last put */
+unsigned char g_gui_dirty[NR_MAX / GUI_TILE + 1][NC_MAX / GUI_TILE + 1];
+/** put the whole framebuffer (window exposed) */
+int g_gui_full;
+
+// ---- per-phase timing, see prof_begin()
+#define PROF_DIFFUSION  0
+#define PROF_FREEZING   1
+#define PROF_ATTACHMENT 2
+#define PROF_MELTING    3
+#define PROF_NOISE      4
+#define PROF_BDRY       5
+#define PROF_RENDER     6
+#define PROF_DRAW       7
+#define PROF_IO         8
+#define PROF_STEP       9
+#define PROF_PHASES     10
+/** histogram bucket k counts the durations in [2^k, 2^(k+1)) ns */
+#define PROF_BUCKETS    40
+
+const char *prof_NAMES[PROF_PHASES] = {"diffusion", "freezing", "attachment", "melting", "noise",
+                                       "boundary",  "render",   "draw",       "io",      "step"};
+
+/** hardware counters of -prof-hw */
+#define PROF_HW 3
+
+const char *prof_HW_NAMES[PROF_HW] = {"cycles", "instructions", "llc_misses"};
+const unsigned long long prof_HW_EVENTS[PROF_HW] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                    PERF_COUNT_HW_CACHE_MISSES};
+/** bytes a last level cache miss moves */
+#define PROF_LINE 64
+
+typedef struct
+{
+    long long start;
+    long long child;
+    long long hw[PROF_HW];
+    long long hw_child[PROF_HW];
+} prof_mark;
+
+typedef struct
+{
+    atomic_llong calls;
+    atomic_llong ns;
+    atomic_llong min_ns;
+    atomic_llong max_ns;
+    atomic_llong hist[PROF_BUCKETS];
+    atomic_llong hw[PROF_HW];
+} prof_phase;
+
+/** timing is on (-prof) */
+int g_prof;
+/** write the counters every this many steps */
+int g_prof_every = 1000;
+char g_prof_path[MAX_IO_PATH_LEN];
+FILE *g_prof_file;
+prof_phase g_prof_phase[PROF_PHASES];
+/** cells of the wedge one sweep of the dynamics visits */
+long long g_prof_cells;
+/** time of the phases nested in the open one, on each thread */
+_Thread_local long long prof_child;
+/** count the hardware events of the phases too (-prof-hw) */
+int g_prof_hw;
+/** counters that could not be opened on some thread, bit per counter */
+atomic_int g_prof_hw_missing;
+/** counter group of the thread: 0 not opened yet, -1 none, else leader fd + 1 */
+_Thread_local int prof_hw_fd;
+_Thread_local int prof_hw_has[PROF_HW];
+_Thread_local long long prof_hw_child[PROF_HW];
+
+// ---- event trace, see trace_record()
+typedef struct
+{
+    const char *name;
+    int tid;
+    long long ts;
+    long long dur;
+} trace_event;
+
+#define TRACE_THREADS 16
+
+/** events are recorded (-trace) */
+int g_trace;
+/** size of the ring, the oldest events are overwritten */
+long g_trace_size = 1 << 20;
+char g_trace_path[MAX_IO_PATH_LEN];
+trace_event *g_trace_ring;
+/** events recorded so far, the ring holds the last g_trace_size */
+long long g_trace_next;
+/** guards the ring and the file, both the viewer and the simulation thread write */
+pthread_mutex_t g_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+long long g_trace_t0;
+/** SIGUSR1: write the trace after the current step */
+volatile sig_atomic_t g_trace_requested;
+const char *g_trace_thread_names[TRACE_THREADS];
+atomic_int g_trace_threads;
+/** trace id of the thread, 0: not yet named */
+_Thread_local int trace_tid;
+
 
 void gui_blue_colors33()
 {
@@ -248,12 +598,548 @@ void gui_off_colors64()
     }
 }
 
+/** places a 16 bit color channel into the bits of `mask` */
+unsigned long gui_mask_channel(unsigned long mask, unsigned short value)
+{
+    int shift = 0, bits = 0;
+
+    if (mask == 0)
+        return 0;
+    while ((mask & 1) == 0)
+    {
+        mask >>= 1;
+        shift++;
+    }
+    while (mask & 1)
+    {
+        mask >>= 1;
+        bits++;
+    }
+    return ((unsigned long)value >> (16 - bits)) << shift;
+}
+
+/**
+ * Sets the pixel value of `c`. On TrueColor visuals it is computed from
+ * the visual's masks without asking the server. Other classes (including
+ * DirectColor, whose colormap need not be an identity ramp) allocate the
+ * color in the colormap, one round trip each, Xlib has no batched
+ * read-only allocation.
+ */
+void gui_color_pixel(XColor *c)
+{
+    Visual *v = DefaultVisual(g_xDisplay, g_xScreen);
+
+    if (v->class == TrueColor)
+    {
+        c->pixel = gui_mask_channel(v->red_mask, c->red) | gui_mask_channel(v->green_mask, c->green) |
+                   gui_mask_channel(v->blue_mask, c->blue);
+        c->flags = DoRed | DoGreen | DoBlue;
+    }
+    else
+    {
+        XAllocColor(g_xDisplay, g_cmap, c);
+    }
+}
+
+/**
+ * Fills the palettes. With `alloc` the pixel values for the display are
+ * set too, otherwise (no display) only the rgb values.
+ */
+void gui_init_colors(int alloc)
+{
+    int i;
+
+    gui_braque_colors64();
+    for (i = 0; i < KAPPA_MAX; i++)
+    {
+        g_color[i].red = g_red[i] * USHRT_MAX / UCHAR_MAX;
+        g_color[i].green = g_green[i] * USHRT_MAX / UCHAR_MAX;
+        g_color[i].blue = g_blue[i] * USHRT_MAX / UCHAR_MAX;
+        if (alloc)
+            gui_color_pixel(&g_color[i]);
+    }
+
+    gui_blue_colors33();
+
+    for (i = 0; i <= 32; i++)
+    {
+
+        g_color_on[i].red = g_red[i] * USHRT_MAX / UCHAR_MAX;
+        g_color_on[i].green = g_green[i] * USHRT_MAX / UCHAR_MAX;
+        g_color_on[i].blue = g_blue[i] * USHRT_MAX / UCHAR_MAX;
+        if (alloc)
+            gui_color_pixel(&g_color_on[i]);
+    }
+
+    gui_off_colors64();
+
+    for (i = 0; i <= 63; i++)
+    {
+
+        g_color_off[63 - i].red = g_red[i] * USHRT_MAX / UCHAR_MAX;
+        g_color_off[63 - i].green = g_green[i] * USHRT_MAX / UCHAR_MAX;
+        g_color_off[63 - i].blue = g_blue[i] * USHRT_MAX / UCHAR_MAX;
+        if (alloc)
+            gui_color_pixel(&g_color_off[63 - i]);
+    }
+
+    // the named colors, without a XAllocNamedColor() lookup each
+    for (i = 0; i < 19; i++)
+    {
+        g_othp[i].red = gui_OTHP_RGB[i][0] * USHRT_MAX / UCHAR_MAX;
+        g_othp[i].green = gui_OTHP_RGB[i][1] * USHRT_MAX / UCHAR_MAX;
+        g_othp[i].blue = gui_OTHP_RGB[i][2] * USHRT_MAX / UCHAR_MAX;
+        if (alloc)
+            gui_color_pixel(&g_othp[i]);
+    }
+}
+
 double uniform_01rand()
 
 {
     return drand48();
 }
 
+void sleep_ms(long ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * Per-phase timing.
+ *
+ * A phase is timed with
+ *
+ *   prof_mark m = prof_begin();
+ *   ...
+ *   prof_end(PROF_..., &m);
+ *
+ * and charged its own time only: the time of phases nested in it (e.g.
+ * createbdry() inside the dynamics) goes to theirs, so the phases add up
+ * to the total. PROF_STEP is the exception, it is the whole step. The
+ * counters are atomic since rendering and I/O also run on the frame
+ * workers and the viewer. Off (the default), a phase costs one branch.
+ */
+long long prof_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/** names the calling thread in the trace */
+void trace_thread(const char *name)
+{
+    int tid;
+
+    if (!g_trace)
+        return;
+    tid = atomic_fetch_add(&g_trace_threads, 1) + 1;
+    if (tid < TRACE_THREADS)
+    {
+        g_trace_thread_names[tid] = name;
+        trace_tid = tid;
+    }
+}
+
+/**
+ * Records an event of `dur` ns starting at `start` (of prof_now()) into
+ * the ring. The ring is shared by all threads under g_trace_lock; events
+ * are per phase, not per cell, so the lock is rarely contended.
+ */
+void trace_record(const char *name, long long start, long long dur)
+{
+    trace_event *e;
+
+    if (!g_trace)
+        return;
+    pthread_mutex_lock(&g_trace_lock);
+    if (g_trace_ring != NULL)
+    {
+        e = &g_trace_ring[g_trace_next++ % g_trace_size];
+        e->name = name;
+        e->tid = trace_tid;
+        e->ts = start;
+        e->dur = dur;
+    }
+    pthread_mutex_unlock(&g_trace_lock);
+}
+
+/** time stamp for trace_span(), 0 when not tracing */
+long long trace_begin()
+{
+    return g_trace ? prof_now() : 0;
+}
+
+void trace_span(const char *name, long long start)
+{
+    if (g_trace)
+        trace_record(name, start, prof_now() - start);
+}
+
+/**
+ * Opens the hardware counters of the calling thread as one group (user
+ * space only), so they are read together with one read(). Counters the
+ * CPU or the kernel (perf_event_paranoid, containers) do not give are
+ * left out and reported as missing.
+ */
+void prof_hw_open()
+{
+    struct perf_event_attr attr;
+    int k, fd, leader = -1;
+
+    for (k = 0; k < PROF_HW; k++)
+    {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = prof_HW_EVENTS[k];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+        prof_hw_has[k] = (fd >= 0);
+        if (fd < 0)
+            atomic_fetch_or(&g_prof_hw_missing, 1 << k);
+        else if (leader < 0)
+            leader = fd;
+    }
+    prof_hw_fd = (leader >= 0) ? leader + 1 : -1;
+}
+
+/** current counts of the thread's counters, 0 for the missing ones */
+void prof_hw_read(long long *v)
+{
+    unsigned long long buf[1 + PROF_HW];
+    int k, n;
+
+    if (prof_hw_fd == 0)
+        prof_hw_open();
+    memset(v, 0, PROF_HW * sizeof(*v));
+    if ((prof_hw_fd < 0) || (read(prof_hw_fd - 1, buf, sizeof(buf)) <= 0))
+        return;
+    for (k = 0, n = 0; k < PROF_HW; k++)
+        if (prof_hw_has[k])
+            v[k] = buf[1 + n++];
+}
+
+prof_mark prof_begin()
+{
+    prof_mark m = {0, 0};
+    int k;
+
+    if (!g_prof && !g_trace)
+        return m;
+    if (g_prof_hw)
+    {
+        prof_hw_read(m.hw);
+        for (k = 0; k < PROF_HW; k++)
+        {
+            m.hw_child[k] = prof_hw_child[k];
+            prof_hw_child[k] = 0;
+        }
+    }
+    m.start = prof_now();
+    m.child = prof_child;
+    prof_child = 0;
+    return m;
+}
+
+void prof_end(int phase, prof_mark *m)
+{
+    prof_phase *p = &g_prof_phase[phase];
+    long long elapsed, ns, old, hw[PROF_HW];
+    int k;
+
+    if (!g_prof && !g_trace)
+        return;
+    elapsed = prof_now() - m->start;
+    if (g_prof_hw)
+    {
+        prof_hw_read(hw);
+        for (k = 0; k < PROF_HW; k++)
+        {
+            hw[k] -= m->hw[k];
+            old = hw[k];
+            if (phase != PROF_STEP)
+                hw[k] -= prof_hw_child[k];
+            prof_hw_child[k] = m->hw_child[k] + old;
+            atomic_fetch_add_explicit(&p->hw[k], hw[k], memory_order_relaxed);
+        }
+    }
+    ns = (phase == PROF_STEP) ? elapsed : elapsed - prof_child;
+    prof_child = m->child + elapsed;
+    trace_record(prof_NAMES[phase], m->start, elapsed);
+    if (!g_prof)
+        return;
+
+    atomic_fetch_add_explicit(&p->calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&p->ns, ns, memory_order_relaxed);
+    old = atomic_load_explicit(&p->min_ns, memory_order_relaxed);
+    while ((ns < old) && !atomic_compare_exchange_weak(&p->min_ns, &old, ns))
+        ;
+    old = atomic_load_explicit(&p->max_ns, memory_order_relaxed);
+    while ((ns > old) && !atomic_compare_exchange_weak(&p->max_ns, &old, ns))
+        ;
+    for (k = 0; (k < PROF_BUCKETS - 1) && (ns >> (k + 1)) > 0; k++)
+        ;
+    atomic_fetch_add_explicit(&p->hist[k], 1, memory_order_relaxed);
+}
+
+/** cells of the wedge in rows 1 ... iup, as the dynamics_*() sweep them */
+long long sweep_cells(int iup)
+{
+    long long cells = 0;
+    int i;
+
+    for (i = 1; (i <= iup) && (i < nr); i++)
+        cells += (i < nr - 1 - i) ? i : nr - 1 - i;
+    return cells;
+}
+
+/** cell updates per second of the dynamics so far */
+double prof_cells_per_s()
+{
+    long long steps = atomic_load(&g_prof_phase[PROF_STEP].calls);
+    long long ns = atomic_load(&g_prof_phase[PROF_STEP].ns);
+
+    return (ns > 0) ? 1e9 * (double)(steps * g_prof_cells) / (double)ns : 0.0;
+}
+
+/** appends the counters to the -prof file as one JSON line */
+void prof_dump()
+{
+    prof_phase *p;
+    int n, k;
+
+    if (g_prof_file == NULL)
+        return;
+
+    fprintf(g_prof_file, "{\"step\":%d,\"radius\":%d,\"cells\":%lld,\"cells_per_s\":%.0f,\"phases\":{", g_pq,
+            g_r_new, g_prof_cells, prof_cells_per_s());
+    for (n = 0; n < PROF_PHASES; n++)
+    {
+        p = &g_prof_phase[n];
+        fprintf(g_prof_file, "%s\"%s\":{\"calls\":%lld,\"ns\":%lld,\"min_ns\":%lld,\"max_ns\":%lld,\"hist\":[",
+                (n > 0) ? "," : "", prof_NAMES[n], atomic_load(&p->calls), atomic_load(&p->ns),
+                atomic_load(&p->calls) ? atomic_load(&p->min_ns) : 0, atomic_load(&p->max_ns));
+        for (k = 0; k < PROF_BUCKETS; k++)
+            fprintf(g_prof_file, "%s%lld", (k > 0) ? "," : "", atomic_load(&p->hist[k]));
+        fprintf(g_prof_file, "]");
+        for (k = 0; g_prof_hw && (k < PROF_HW); k++)
+        {
+            if (atomic_load(&g_prof_hw_missing) & (1 << k))
+                fprintf(g_prof_file, ",\"%s\":null", prof_HW_NAMES[k]);
+            else
+                fprintf(g_prof_file, ",\"%s\":%lld", prof_HW_NAMES[k], atomic_load(&p->hw[k]));
+        }
+        fprintf(g_prof_file, "}");
+    }
+    fprintf(g_prof_file, "}}\n");
+    fflush(g_prof_file);
+}
+
+void prof_start()
+{
+    int n;
+
+    if (!g_prof)
+        return;
+
+    for (n = 0; n < PROF_PHASES; n++)
+        atomic_init(&g_prof_phase[n].min_ns, LLONG_MAX);
+    g_prof_cells = sweep_cells(nr - 1);
+
+    if (strcmp(g_prof_path, "-") != 0)
+    {
+        g_prof_file = fopen(g_prof_path, "w");
+        if (g_prof_file == NULL)
+            fprintf(stderr, ".prof_start: cannot open '%s'\n", g_prof_path);
+    }
+}
+
+void trace_on_signal(int sig)
+{
+    g_trace_requested = 1;
+}
+
+void trace_start()
+{
+    if (!g_trace)
+        return;
+
+    if (g_trace_size < 1)
+        g_trace_size = 1;
+    g_trace_ring = calloc(g_trace_size, sizeof(trace_event));
+    g_trace_next = 0;
+    g_trace_t0 = prof_now();
+    g_trace_thread_names[0] = "other";
+    atomic_init(&g_trace_threads, 0);
+    trace_thread("main");
+    signal(SIGUSR1, trace_on_signal);
+}
+
+/**
+ * Writes the events in the ring as Chrome trace-event JSON (complete
+ * events, one track per thread), to be loaded in chrome://tracing or
+ * Perfetto. Called with g_trace_lock held, so events recorded meanwhile
+ * wait and a write asked for from two threads is not interleaved.
+ */
+void trace_write()
+{
+    FILE *f;
+    long long next, k, first;
+    trace_event *e;
+    int n, tid, sep = 0;
+
+    if (g_trace_ring == NULL)
+        return;
+
+    f = fopen(g_trace_path, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, ".trace_write: cannot open '%s'\n", g_trace_path);
+        return;
+    }
+
+    next = g_trace_next;
+    first = (next > g_trace_size) ? next - g_trace_size : 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    n = atomic_load(&g_trace_threads);
+    for (tid = 0; (tid <= n) && (tid < TRACE_THREADS); tid++)
+    {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                sep ? ",\n" : "", tid, g_trace_thread_names[tid]);
+        sep = 1;
+    }
+    for (k = first; k < next; k++)
+    {
+        e = &g_trace_ring[k % g_trace_size];
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", e->name,
+                e->tid, (e->ts - g_trace_t0) / 1e3, e->dur / 1e3);
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    printf(".trace_write: %lld events written to '%s'%s\n", next - first, g_trace_path,
+           (first > 0) ? " (ring full, older ones dropped)" : "");
+}
+
+/** writes the trace if it was asked for with SIGUSR1 */
+void trace_check()
+{
+    if (g_trace_requested)
+    {
+        pthread_mutex_lock(&g_trace_lock);
+        if (g_trace_requested)
+        {
+            g_trace_requested = 0;
+            trace_write();
+        }
+        pthread_mutex_unlock(&g_trace_lock);
+    }
+}
+
+void trace_finish()
+{
+    pthread_mutex_lock(&g_trace_lock);
+    if (g_trace_ring != NULL)
+    {
+        trace_write();
+        free(g_trace_ring);
+        g_trace_ring = NULL;
+    }
+    pthread_mutex_unlock(&g_trace_lock);
+}
+
+/** called after every step, writes the counters when due */
+void prof_check()
+{
+    trace_check();
+    if ((g_prof_file != NULL) && (g_prof_every > 0) && (g_pq % g_prof_every == 0))
+        prof_dump();
+}
+
+/**
+ * Hardware counters per phase: instructions per cycle, and the last level
+ * cache misses per cell of the wedge and call with the memory traffic
+ * they imply. A phase moving much more than the ~40 bytes its fields
+ * take per cell, at a rate close to the machine's bandwidth, is bound by
+ * memory; a high IPC with few misses by compute.
+ */
+void prof_hw_report()
+{
+    prof_phase *p;
+    long long cyc, ins, mis, calls;
+    int n, missing;
+
+    missing = atomic_load(&g_prof_hw_missing);
+    if (missing == (1 << PROF_HW) - 1)
+    {
+        printf(".prof_finish: no hardware counters (perf_event_open not permitted or not supported)\n");
+        return;
+    }
+    printf(".prof_finish: %-10s %8s %14s %14s %10s\n", "phase", "IPC", "misses/cell", "bytes/cell", "GB/s");
+    for (n = 0; n < PROF_PHASES; n++)
+    {
+        p = &g_prof_phase[n];
+        calls = atomic_load(&p->calls);
+        if ((calls == 0) || (g_prof_cells == 0))
+            continue;
+        cyc = atomic_load(&p->hw[0]);
+        ins = atomic_load(&p->hw[1]);
+        mis = atomic_load(&p->hw[2]);
+        printf(".prof_finish: %-10s", prof_NAMES[n]);
+        if (!(missing & 3) && (cyc > 0))
+            printf(" %8.2f", (double)ins / cyc);
+        else
+            printf(" %8s", "-");
+        if (!(missing & 4))
+            printf(" %14.3f %14.1f %10.2f\n", (double)mis / calls / g_prof_cells,
+                   (double)mis * PROF_LINE / calls / g_prof_cells,
+                   (atomic_load(&p->ns) > 0) ? (double)mis * PROF_LINE / atomic_load(&p->ns) : 0.0);
+        else
+            printf(" %14s %14s %10s\n", "-", "-", "-");
+    }
+}
+
+/** prints the summary and writes the counters a last time */
+void prof_finish()
+{
+    prof_phase *p;
+    long long total = 0;
+    int n;
+
+    if (!g_prof)
+        return;
+
+    for (n = 0; n < PROF_STEP; n++)
+        total += atomic_load(&g_prof_phase[n].ns);
+    printf(".prof_finish: %-10s %10s %12s %6s %12s %12s\n", "phase", "calls", "total [ms]", "%", "mean [us]",
+           "max [us]");
+    for (n = 0; n < PROF_PHASES; n++)
+    {
+        p = &g_prof_phase[n];
+        if (atomic_load(&p->calls) == 0)
+            continue;
+        printf(".prof_finish: %-10s %10lld %12.3f %6.1f %12.3f %12.3f\n", prof_NAMES[n], atomic_load(&p->calls),
+               atomic_load(&p->ns) / 1e6, (n < PROF_STEP) && (total > 0) ? 100.0 * atomic_load(&p->ns) / total : 100.0,
+               atomic_load(&p->ns) / 1e3 / atomic_load(&p->calls), atomic_load(&p->max_ns) / 1e3);
+    }
+    printf(".prof_finish: %lld cells per step, %.3g cell updates/s\n", g_prof_cells, prof_cells_per_s());
+    if (g_prof_hw)
+        prof_hw_report();
+
+    prof_dump();
+    if (g_prof_file != NULL)
+        fclose(g_prof_file);
+    g_prof_file = NULL;
+}
+
 int norm_inf(int i, int j)
 {
     if (i < 0)
@@ -327,6 +1213,9 @@ void createbdry()
 {
     int i, j;
 
+    prof_mark m;
+
+    m = prof_begin();
     for (j = 2; j < nc; j++)
     {
         ash[j - 1][j] = ash[j][j - 1];
@@ -390,6 +1279,7 @@ void createbdry()
     b__fr[nr - 1][0] = b__fr[nr - 3][2];
     a_pic[nr - 1][0] = a_pic[nr - 3][2];
     c__lm[nr - 1][0] = c__lm[nr - 3][2];
+    prof_end(PROF_BDRY, &m);
 }
 
 void buildbig()
@@ -416,56 +1306,430 @@ void buildbig()
         }
 }
 
-void checkmass()
-
+/**
+ * Order of the cells for the freezing and the attachment (-order). "rows"
+ * is the row by row sweep of the wedge. "morton" and "hilbert" go through
+ * tiles of ORDER_TILE x ORDER_TILE cells along that curve, and skip the
+ * tiles that cannot hold a boundary cell: those all crystal, and those
+ * with no crystal in them or in the 8 tiles around.
+ */
+#define ORDER_ROWS 0
+#define ORDER_MORTON 1
+#define ORDER_HILBERT 2
+#define ORDER_TILE 16
+#define ORDER_TILES (NR_MAX / ORDER_TILE + 1)
+/** side of the curve, a power of 2 >= ORDER_TILES */
+#define ORDER_SIDE 64
+
+const char *order_NAMES[] = {"rows", "morton", "hilbert"};
+
+/** the cells j0 .. j1 of row i */
+typedef struct
 {
+    int i, j0, j1;
+} order_seg;
+
+int g_order;
+/** the tiles of the wedge along the curve, ti, tj and the key */
+int g_order_tiles[ORDER_TILES * ORDER_TILES][3];
+int g_order_ntiles;
+/** wedge and crystal cells of each tile */
+int g_order_cells[ORDER_TILES][ORDER_TILES];
+int g_order_crystal[ORDER_TILES][ORDER_TILES];
+order_seg g_order_segs[NR_MAX * ORDER_TILES];
+
+/** position of tile (x, y) on the curve */
+int order_key(int x, int y)
+{
+    int key = 0, s, rx, ry, t;
 
-    int i, j, i1, j1, iup, no;
-    double totalmass;
-    totalmass = 0.0;
-
-    buildbig();
-
-    for (i = 2; i <= nr - 2; i++)
+    if (g_order == ORDER_MORTON)
+    {
+        for (s = 0; (1 << s) < ORDER_SIDE; s++)
+            key |= (((x >> s) & 1) << (2 * s + 1)) | (((y >> s) & 1) << (2 * s));
+        return key;
+    }
+    for (s = ORDER_SIDE / 2; s > 0; s /= 2)
     {
-        for (j = 1; i + j <= nr - 1; j++)
+        rx = (x & s) > 0;
+        ry = (y & s) > 0;
+        key += s * s * ((3 * rx) ^ ry);
+        if (ry == 0)
         {
-            totalmass += d_dif[i][j] + b__fr[i][j] + c__lm[i][j];
+            if (rx == 1)
+            {
+                x = ORDER_SIDE - 1 - x;
+                y = ORDER_SIDE - 1 - y;
+            }
+            t = x;
+            x = y;
+            y = t;
         }
     }
-    totalmass += d_dif[1][1] + b__fr[1][1] + c__lm[i][j];
-    printf("total mass=%.10lf\n", totalmass);
+    return key;
 }
 
-void initialize()
-
+int order_compare(const void *a, const void *b)
 {
-    time_t t1, t2;
-    int i, j, k;
-    double x;
-    double x1, y1;
-
-    printf(".initialize: creating init. state\n");
-    g_pq = 0;
-
-    g_stop = false;
-    g_par_update = 0;
+    return ((const int *)a)[2] - ((const int *)b)[2];
+}
 
-    t1 = time(&t2);
-    t1 = t1 % 1000;
-    srand48(t1);
-    printf("seed:%ld\n", t1);
+/** the tiles along the curve and their crystal cells (new or read state) */
+void order_reset()
+{
+    int i, j, jend, ti, tj;
 
-    for (i = 1; i < t1; i++)
+    if (g_order == ORDER_ROWS)
+        return;
+    memset(g_order_cells, 0, sizeof(g_order_cells));
+    memset(g_order_crystal, 0, sizeof(g_order_crystal));
+    for (i = 1; i < nr; i++)
     {
-        x = drand48();
+        jend = (i < nr - 1 - i) ? i : nr - 1 - i;
+        for (j = 1; j <= jend; j++)
+        {
+            g_order_cells[i / ORDER_TILE][j / ORDER_TILE]++;
+            g_order_crystal[i / ORDER_TILE][j / ORDER_TILE] += a_pic[i][j];
+        }
     }
+    g_order_ntiles = 0;
+    for (ti = 0; ti < ORDER_TILES; ti++)
+        for (tj = 0; tj <= ti; tj++)
+            if (g_order_cells[ti][tj] > 0)
+            {
+                g_order_tiles[g_order_ntiles][0] = ti;
+                g_order_tiles[g_order_ntiles][1] = tj;
+                g_order_tiles[g_order_ntiles][2] = order_key(ti, tj);
+                g_order_ntiles++;
+            }
+    qsort(g_order_tiles, g_order_ntiles, sizeof(g_order_tiles[0]), order_compare);
+}
 
-    g_center_i = 1;
-    g_center_j = 1;
+/** whether tile (ti, tj) can hold a boundary cell */
+int order_active(int ti, int tj)
+{
+    int di, dj;
 
-    g_r_old = 0;
-    g_r_new = 0;
+    if (g_order_crystal[ti][tj] == g_order_cells[ti][tj])
+        return 0;
+    for (di = -1; di <= 1; di++)
+        for (dj = -1; dj <= 1; dj++)
+            if ((ti + di >= 0) && (ti + di < ORDER_TILES) && (tj + dj >= 0) && (tj + dj < ORDER_TILES) &&
+                (g_order_crystal[ti + di][tj + dj] > 0))
+                return 1;
+    return 0;
+}
+
+/**
+ * Fills g_order_segs with the pieces of the rows 1 .. iup of the wedge
+ * in the order of -order, returns their number.
+ */
+int order_segments(int iup)
+{
+    int n = 0, t, i, ti, tj, jend, j0, j1;
+
+    if (g_order == ORDER_ROWS)
+    {
+        for (i = 1; i <= iup; i++)
+        {
+            jend = (i < nr - 1 - i) ? i : nr - 1 - i;
+            if (jend < 1)
+                continue;
+            g_order_segs[n].i = i;
+            g_order_segs[n].j0 = 1;
+            g_order_segs[n].j1 = jend;
+            n++;
+        }
+        return n;
+    }
+    for (t = 0; t < g_order_ntiles; t++)
+    {
+        ti = g_order_tiles[t][0];
+        tj = g_order_tiles[t][1];
+        if ((ti * ORDER_TILE > iup) || !order_active(ti, tj))
+            continue;
+        for (i = (ti > 0) ? ti * ORDER_TILE : 1; (i < (ti + 1) * ORDER_TILE) && (i <= iup); i++)
+        {
+            jend = (i < nr - 1 - i) ? i : nr - 1 - i;
+            j0 = (tj > 0) ? tj * ORDER_TILE : 1;
+            j1 = ((tj + 1) * ORDER_TILE - 1 < jend) ? (tj + 1) * ORDER_TILE - 1 : jend;
+            if (j0 > j1)
+                continue;
+            g_order_segs[n].i = i;
+            g_order_segs[n].j0 = j0;
+            g_order_segs[n].j1 = j1;
+            n++;
+        }
+    }
+    return n;
+}
+
+/**
+ * Mass.
+ *
+ * The mass is that of a sixth of the lattice, as checkmass() always
+ * summed it after buildbig(): rows 2 ... nr-2 and the center cell. In the
+ * wedge a cell off the diagonal (j >= 2) stands for itself and its
+ * mirror image, hence counts twice.
+ *
+ * The phases keep the totals of vapor, boundary and crystal mass up to
+ * date from the amounts they move: freezing, melting and attachment
+ * between the kinds, noise and the mass correction of the diffusion to
+ * and from the outside. A recount (mass_audit()) shows what the fluxes
+ * miss, i.e. the mass diffusion does not conserve and rounding.
+ */
+double mass_weight(int i, int j)
+{
+    return ((j >= 2) && (j < i)) ? 2.0 : 1.0;
+}
+
+/** adds `x` to the sum `s` with compensation `c` (Neumaier) */
+void mass_add(double *s, double *c, double x)
+{
+    double t = *s + x;
+
+    if (fabs(*s) >= fabs(x))
+        *c += (*s - t) + x;
+    else
+        *c += (x - t) + *s;
+    *s = t;
+}
+
+/** recounts the mass (and crystal cells) of the wedge, with compensated sums */
+void mass_audit(double *vapor, double *boundary, double *crystal, long *attached)
+{
+    double s[3] = {0.0, 0.0, 0.0}, c[3] = {0.0, 0.0, 0.0};
+    double w;
+    int i, j;
+
+    *attached = a_pic[1][1];
+    for (i = 2; i <= nr - 2; i++)
+    {
+        for (j = 1; (j <= i) && (i + j <= nr - 1); j++)
+        {
+            w = mass_weight(i, j);
+            mass_add(&s[0], &c[0], w * d_dif[i][j]);
+            mass_add(&s[1], &c[1], w * b__fr[i][j]);
+            mass_add(&s[2], &c[2], w * c__lm[i][j]);
+            *attached += (long)w * a_pic[i][j];
+        }
+    }
+    *vapor = s[0] + c[0] + d_dif[1][1];
+    *boundary = s[1] + c[1] + b__fr[1][1];
+    *crystal = s[2] + c[2] + c__lm[1][1];
+}
+
+/** starts the tracking from a recount (new or read state) */
+void mass_reset()
+{
+    mass_audit(&g_mass_vapor, &g_mass_boundary, &g_mass_crystal, &g_attached);
+    g_frontier = 0;
+    order_reset();
+}
+
+/** called after every step, recounts the mass when due */
+void mass_check()
+{
+    double vapor, boundary, crystal, total, tracked;
+    long attached;
+
+    if ((g_mass_audit_every <= 0) || (g_pq % g_mass_audit_every != 0))
+        return;
+
+    mass_audit(&vapor, &boundary, &crystal, &attached);
+    total = vapor + boundary + crystal;
+    tracked = g_mass_vapor + g_mass_boundary + g_mass_crystal;
+    printf(".mass_check: time %d vapor %.10lf boundary %.10lf crystal %.10lf total %.10lf, tracked %.10lf (%+.3g)\n",
+           g_pq, vapor, boundary, crystal, total, tracked, total - tracked);
+    g_mass_vapor = vapor;
+    g_mass_boundary = boundary;
+    g_mass_crystal = crystal;
+}
+
+/** prints the total mass as tracked by the phases */
+void checkmass()
+
+{
+    printf("total mass=%.10lf\n", g_mass_vapor + g_mass_boundary + g_mass_crystal);
+}
+
+/**
+ * Observables, a CSV line every -obs-every steps: radius, crystal and
+ * frontier cells, the mass of vapor, boundary and crystal, and the tip
+ * velocity (growth of the radius per step since the last line). All are
+ * kept up to date by the phases (see mass_weight()), so a line costs no
+ * pass over the lattice. Cells and mass are those of a sixth of the lattice.
+ */
+void obs_start()
+{
+    if (g_obs_path[0] == '\0')
+        return;
+
+    g_obs_file = fopen(g_obs_path, "w");
+    if (g_obs_file == NULL)
+    {
+        fprintf(stderr, ".obs_start: cannot open '%s'\n", g_obs_path);
+        return;
+    }
+    fprintf(g_obs_file, "time,radius,attached,frontier,vapor,boundary,crystal,total,tip_velocity\n");
+    g_obs_last_pq = g_pq;
+    g_obs_last_r = g_r_new;
+}
+
+/** called after every step, writes a line when due */
+void obs_check()
+{
+    double v;
+
+    if ((g_obs_file == NULL) || (g_obs_every <= 0) || (g_pq % g_obs_every != 0))
+        return;
+
+    v = (g_pq > g_obs_last_pq) ? (double)(g_r_new - g_obs_last_r) / (g_pq - g_obs_last_pq) : 0.0;
+    fprintf(g_obs_file, "%d,%d,%ld,%ld,%.10g,%.10g,%.10g,%.10g,%.6g\n", g_pq, g_r_new, g_attached, g_frontier,
+            g_mass_vapor, g_mass_boundary, g_mass_crystal, g_mass_vapor + g_mass_boundary + g_mass_crystal, v);
+    g_obs_last_pq = g_pq;
+    g_obs_last_r = g_r_new;
+}
+
+void obs_finish()
+{
+    if (g_obs_file != NULL)
+        fclose(g_obs_file);
+    g_obs_file = NULL;
+}
+
+/**
+ * Termination. Besides the radius beyond 2/3 of the lattice (set by
+ * dynamics_attachment()), a run stops when
+ *
+ *   steps          -steps N were done
+ *   target-radius  the radius reached -stop-radius R
+ *   idle           no cell attached for -stop-idle K steps
+ *   vapor          no vapor cell changed by more than -stop-vapor TOL
+ *                  in the last diffusion
+ *   mass           the shares of vapor, boundary and crystal mass moved
+ *                  less than -stop-mass TOL over -stop-window steps
+ *   seconds        -stop-seconds S of wall clock passed
+ *
+ * idle, vapor and mass are not checked in the first -stop-window steps
+ * of a run, while the vapor only starts to move. All are read from what
+ * the phases keep up to date, a check costs no pass over the lattice.
+ * The reason is in `g_stop_reason`.
+ */
+void stop_fractions(double *frac)
+{
+    double total = g_mass_vapor + g_mass_boundary + g_mass_crystal;
+
+    if (total <= 0.0)
+        total = 1.0;
+    frac[0] = g_mass_vapor / total;
+    frac[1] = g_mass_boundary / total;
+    frac[2] = g_mass_crystal / total;
+}
+
+/** before the first step of a run */
+void stop_start()
+{
+    g_stop_t0 = prof_now();
+    g_stop_reported = 0;
+    g_stop_attached = g_attached;
+    g_stop_attach_pq = g_pq;
+    g_stop_start_pq = g_pq;
+    stop_fractions(g_stop_frac);
+}
+
+void stop_set(int reason)
+{
+    g_stop = true;
+    g_stop_reason = reason;
+}
+
+/** called after every step, sets g_stop when a condition is met */
+void stop_check()
+{
+    double frac[3], d;
+    int k, settled;
+
+    if (g_stop)
+    {
+        // the radius is checked by dynamics_attachment(), report it once
+        if (!g_stop_reported)
+            printf(".stop_check: stopped at time %d, reason: %s\n", g_pq, stop_NAMES[g_stop_reason]);
+        g_stop_reported = 1;
+        return;
+    }
+
+    if (g_attached != g_stop_attached)
+    {
+        g_stop_attached = g_attached;
+        g_stop_attach_pq = g_pq;
+    }
+
+    settled = (g_pq - g_stop_start_pq >= g_stop_window);
+    if ((g_max_steps > 0) && (g_pq >= g_max_steps))
+        stop_set(STOP_STEPS);
+    else if ((g_stop_radius > 0) && (g_r_new >= g_stop_radius))
+        stop_set(STOP_TARGET);
+    else if ((g_stop_seconds > 0.0) && (prof_now() - g_stop_t0 >= g_stop_seconds * 1e9))
+        stop_set(STOP_SECONDS);
+    else if (!settled)
+        ;
+    else if ((g_stop_idle > 0) && (g_pq - g_stop_attach_pq >= g_stop_idle))
+        stop_set(STOP_IDLE);
+    else if ((g_stop_vapor > 0.0) && (g_vapor_change < g_stop_vapor))
+        stop_set(STOP_VAPOR);
+    else if ((g_stop_mass > 0.0) && (g_stop_window > 0) && (g_pq % g_stop_window == 0))
+    {
+        stop_fractions(frac);
+        d = 0.0;
+        for (k = 0; k < 3; k++)
+        {
+            if (fabs(frac[k] - g_stop_frac[k]) > d)
+                d = fabs(frac[k] - g_stop_frac[k]);
+            g_stop_frac[k] = frac[k];
+        }
+        if (d < g_stop_mass)
+            stop_set(STOP_MASS);
+    }
+    if (g_stop)
+    {
+        printf(".stop_check: stopped at time %d, reason: %s\n", g_pq, stop_NAMES[g_stop_reason]);
+        g_stop_reported = 1;
+    }
+}
+
+void initialize()
+
+{
+    time_t t1, t2;
+    int i, j, k;
+    double x;
+    double x1, y1;
+
+    printf(".initialize: creating init. state\n");
+    g_pq = 0;
+
+    g_stop = false;
+    g_stop_reason = STOP_NONE;
+    g_par_update = 0;
+
+    t1 = time(&t2);
+    t1 = t1 % 1000;
+    if (g_seed >= 0)
+        t1 = g_seed;
+    srand48(t1);
+    printf("seed:%ld\n", t1);
+
+    for (i = 1; i < t1; i++)
+    {
+        x = drand48();
+    }
+
+    g_center_i = 1;
+    g_center_j = 1;
+
+    g_r_old = 0;
+    g_r_new = 0;
 
     for (i = 1; i < nr; i++)
     {
@@ -529,6 +1793,7 @@ void initialize()
 
     createbdry();
     buildbig();
+    mass_reset();
     printf(".initialize: init. finished\n");
 }
 
@@ -536,18 +1801,22 @@ void dynamics_diffusion()
 
 {
 
-    double b[NR_MAX][NC_MAX];
-    double x, y;
+    double b[NR_MAX][NC_MAX] __attribute__((aligned(64)));
+    double x;
     int i, j, k;
-    int id, iu, jl, jr;
     int jend;
-    int part;
     int count;
-    double b1, b2;
     double masscorrection;
     int nrhalf;
-
-    for (i = 1; i < nr; i++)
+    int ilast;
+    const int *a = &a_pic[0][0];
+    double *d = &d_dif[0][0];
+    double *nb = &b[0][0];
+
+    // in a block of tile_begin() only the near rows and a shrinking halo,
+    // tile_end() does the rest and the mass correction
+    ilast = (g_tile_T > 0) ? g_tile_N + g_tile_T - g_tile_done - 1 : nr - 1;
+    for (i = 1; i <= ilast; i++)
         for (j = 1; ((j <= i) && (i + j <= nr - 1)); j++)
         {
             b[i][j] = 0.0;
@@ -559,55 +1828,53 @@ void dynamics_diffusion()
         masscorrection = (1.0 / 7.0) * (d_dif[nr - 2][2] + d_dif[nr - 3][3] - d_dif[nrhalf][nr - nrhalf] -
                                         d_dif[nrhalf + 1][nr - nrhalf - 1]);
 
-    for (i = 1; i < nr; i++)
+    for (i = 1; i <= ilast; i++)
     {
-        for (j = 1; ((j <= i) && (i + j <= nr - 1)); j++)
+        jend = (i < nr - 1 - i) ? i : nr - 1 - i;
+        for (k = HEX_INDEX(i, 1); k <= HEX_INDEX(i, jend); k++)
         {
-            if (a_pic[i][j] == 0)
+            if (a[k] == 0)
             {
-                id = (i + 1);
-                iu = (i - 1);
-                jr = (j + 1);
-                jl = (j - 1);
-                count = 0;
-                if (a_pic[id][j] == 0)
-                    count++;
-                if (a_pic[iu][j] == 0)
-                    count++;
-                if (a_pic[i][jl] == 0)
-                    count++;
-                if (a_pic[i][jr] == 0)
-                    count++;
-                if (a_pic[iu][jr] == 0)
-                    count++;
-                if (a_pic[id][jl] == 0)
-                    count++;
+                count = (a[k + HEX_DOWN] == 0) + (a[k + HEX_UP] == 0) + (a[k + HEX_LEFT] == 0) +
+                        (a[k + HEX_RIGHT] == 0) + (a[k + HEX_UP_RIGHT] == 0) + (a[k + HEX_DOWN_LEFT] == 0);
 
                 if (count == 0)
-                    b[i][j] = d_dif[i][j];
+                    nb[k] = d[k];
                 else
                 {
 
-                    b[i][j] = (1.0 - (double)count / 7.0) * d_dif[i][j] +
-                              (d_dif[id][j] * (1.0 - a_pic[id][j]) + d_dif[iu][j] * (1.0 - a_pic[iu][j]) +
-                               d_dif[i][jl] * (1.0 - a_pic[i][jl]) + d_dif[i][jr] * (1.0 - a_pic[i][jr]) +
-                               d_dif[iu][jr] * (1.0 - a_pic[iu][jr]) + d_dif[id][jl] * (1.0 - a_pic[id][jl])) /
-                                  7.0;
+                    nb[k] = (1.0 - (double)count / 7.0) * d[k] +
+                            (d[k + HEX_DOWN] * (1.0 - a[k + HEX_DOWN]) + d[k + HEX_UP] * (1.0 - a[k + HEX_UP]) +
+                             d[k + HEX_LEFT] * (1.0 - a[k + HEX_LEFT]) + d[k + HEX_RIGHT] * (1.0 - a[k + HEX_RIGHT]) +
+                             d[k + HEX_UP_RIGHT] * (1.0 - a[k + HEX_UP_RIGHT]) +
+                             d[k + HEX_DOWN_LEFT] * (1.0 - a[k + HEX_DOWN_LEFT])) /
+                                7.0;
                 }
             }
         }
     }
 
-    for (i = 1; i < nr; i++)
+    g_vapor_change = 0.0;
+    for (i = 1; i <= ilast; i++)
     {
-        for (j = 1; ((j <= i) && (i + j <= nr - 1)); j++)
+        jend = (i < nr - 1 - i) ? i : nr - 1 - i;
+        for (k = HEX_INDEX(i, 1); k <= HEX_INDEX(i, jend); k++)
         {
-            if (a_pic[i][j] == 0)
-                d_dif[i][j] = b[i][j];
+            if (a[k] == 0)
+            {
+                x = fabs(nb[k] - d[k]);
+                if (x > g_vapor_change)
+                    g_vapor_change = x;
+                d[k] = nb[k];
+            }
         }
     }
 
-    d_dif[nr - 2][1] -= masscorrection;
+    if (g_tile_T == 0)
+    {
+        d_dif[nr - 2][1] -= masscorrection;
+        g_mass_vapor -= mass_weight(nr - 2, 1) * masscorrection;
+    }
     createbdry();
 }
 
@@ -615,13 +1882,9 @@ void dynamics_add_noise()
 
 {
 
-    double b[NR_MAX][NC_MAX];
-    double x, y;
-    int i, j, k;
-    int id, iu, jl, jr;
-    int part;
-    int count;
-    double offset;
+    double x;
+    int i, j;
+    double dmass = 0.0;
 
     for (i = 1; i < nr; i++)
     {
@@ -631,12 +1894,17 @@ void dynamics_add_noise()
             x = uniform_01rand();
             if (x < 0.5)
             {
+                dmass += mass_weight(i, j) * d_dif[i][j] * sigma;
                 d_dif[i][j] = d_dif[i][j] * (1 + sigma);
             }
             else
+            {
+                dmass -= mass_weight(i, j) * d_dif[i][j] * sigma;
                 d_dif[i][j] = d_dif[i][j] * (1 - sigma);
+            }
         }
     }
+    g_mass_vapor += dmass;
     createbdry();
 }
 
@@ -656,6 +1924,7 @@ void dynamics_add_noise1()
                 {
                     offset = sigma * d_dif[i][j];
                     d_dif[i][j] += offset;
+                    g_mass_vapor += mass_weight(i, j) * offset;
                 }
             }
     }
@@ -665,15 +1934,11 @@ void dynamics_melting()
 
 {
 
-    double x, y, afrij;
-    int i, j, k;
-    int id, iu, jl, jr;
-    int part;
-    int count;
-    double offset;
-    double difmass;
+    double y, afrij;
+    int i, j;
+    double w, from_b = 0.0, from_c = 0.0;
 
-    int ilo, iup, jlo, jup;
+    int iup;
 
     iup = g_center_i + g_r_new + 1;
     g_is_fr_changed = false;
@@ -684,11 +1949,13 @@ void dynamics_melting()
         {
             if (a_pic[i][j] == 0)
             {
+                w = mass_weight(i, j);
 
                 afrij = b__fr[i][j];
                 y = afrij * mu;
                 b__fr[i][j] = b__fr[i][j] - y;
                 d_dif[i][j] = d_dif[i][j] + y;
+                from_b += w * y;
 
                 afrij = c__lm[i][j];
                 if (afrij > 0.0)
@@ -696,117 +1963,120 @@ void dynamics_melting()
                     y = afrij * gam;
                     c__lm[i][j] = c__lm[i][j] - y;
                     d_dif[i][j] = d_dif[i][j] + y;
+                    from_c += w * y;
                 }
             }
         }
     }
+    g_mass_boundary -= from_b;
+    g_mass_crystal -= from_c;
+    g_mass_vapor += from_b + from_c;
 
     createbdry();
 }
 
+/**
+ * The attachment rules by the number of crystal neighbours of a boundary
+ * cell: 1 or 2 attach with b__fr >= beta, 3 with b__fr >= 1 or with
+ * b__fr >= alpha and at most theta vapor around, 4 and more always. The
+ * class of n neighbours is (n > 0) + (n > 2) + (n > 3).
+ */
+#define ATTACH_NONE 0
+#define ATTACH_BETA 1
+#define ATTACH_THETA 2
+#define ATTACH_ALWAYS 3
+
 void dynamics_attachment()
 
 {
 
-    int bpic[NR_MAX][NC_MAX];
+    int bpic[NR_MAX][NC_MAX] __attribute__((aligned(64)));
 
-    double x, y, afrij;
+    double afrij;
     int i, j, k;
-    int id, iu, jl, jr;
-    int part;
     int count;
-    double offset;
-    double nfrsum;
-    double frmass, difmass;
+    int cls[NC_MAX];
+    int attach;
+    int n, nseg;
+    double difmass;
+    double attached = 0.0;
+    const int *a = &a_pic[0][0];
+    const double *d = &d_dif[0][0], *bf = &b__fr[0][0];
+    int *nb = &bpic[0][0];
 
-    int ilo, iup, jlo, jup;
+    int iup, jlo, jup;
 
     iup = g_center_i + g_r_new + 1;
     g_is_fr_changed = false;
 
-    for (i = 1; i <= iup; i++)
-        for (j = 1; ((j <= i) && (i + j <= nr - 1)); j++)
+    // per piece of a row (see order_segments()) first the rule class of
+    // every cell, a branchless pass (vectorized with -O3), then the rules
+    // for the few cells at the boundary; the vapor around is only summed
+    // for the 3-neighbour cells that need it
+    nseg = order_segments(iup);
+    for (n = 0; n < nseg; n++)
+    {
+        i = g_order_segs[n].i;
+        jlo = g_order_segs[n].j0;
+        jup = g_order_segs[n].j1;
+        for (j = jlo; j <= jup; j++)
         {
-
-            bpic[i][j] = a_pic[i][j];
+            k = HEX_INDEX(i, j);
+            count = a[k + HEX_DOWN] + a[k + HEX_UP] + a[k + HEX_LEFT] + a[k + HEX_RIGHT] + a[k + HEX_UP_RIGHT] +
+                    a[k + HEX_DOWN_LEFT];
+            cls[j] = ((count > 0) + (count > 2) + (count > 3)) * (1 - a[k]);
+            nb[k] = a[k];
         }
-    for (i = 1; i <= iup; i++)
-    {
-        for (j = 1; ((j <= i) && (i + j <= nr - 1)); j++)
+        for (j = jlo; j <= jup; j++)
         {
-
-            if (a_pic[i][j] == 0)
+            if (cls[j] == ATTACH_NONE)
+                continue;
+            k = HEX_INDEX(i, j);
+            afrij = bf[k];
+            attach = (cls[j] == ATTACH_ALWAYS) | ((cls[j] == ATTACH_BETA) & (afrij >= beta)) |
+                     ((cls[j] == ATTACH_THETA) & (afrij >= 1.0));
+            if ((cls[j] == ATTACH_THETA) && !attach && (afrij >= alpha))
             {
-
-                id = i + 1;
-                iu = i - 1;
-                jr = j + 1;
-                jl = j - 1;
-                count = 0;
-                if (a_pic[id][j] == 1)
-                    count++;
-                if (a_pic[iu][j] == 1)
-                    count++;
-                if (a_pic[i][jl] == 1)
-                    count++;
-                if (a_pic[i][jr] == 1)
-                    count++;
-                if (a_pic[iu][jr] == 1)
-                    count++;
-                if (a_pic[id][jl] == 1)
-                    count++;
-
-                if (count >= 1)
-                {
-
-                    difmass = d_dif[i][j] + d_dif[id][j] * (1 - a_pic[id][j]) + d_dif[iu][j] * (1 - a_pic[iu][j]) +
-                              d_dif[i][jl] * (1 - a_pic[i][jl]) + d_dif[i][jr] * (1 - a_pic[i][jr]) +
-                              d_dif[iu][jr] * (1 - a_pic[iu][jr]) + d_dif[id][jl] * (1 - a_pic[id][jl]);
-
-                    if (count <= 2)
-                    {
-
-                        if (b__fr[i][j] >= beta)
-                        {
-                            bpic[i][j] = 1;
-                        }
-                    }
-
-                    if (count >= 3)
-                    {
-
-                        if ((b__fr[i][j] >= 1.0) || ((difmass <= theta) && (b__fr[i][j] >= alpha)))
-                        {
-                            bpic[i][j] = 1;
-                        }
-                    }
-                    if (count >= 4)
-                        bpic[i][j] = 1;
-                }
+                difmass = d[k] + d[k + HEX_DOWN] * (1 - a[k + HEX_DOWN]) + d[k + HEX_UP] * (1 - a[k + HEX_UP]) +
+                          d[k + HEX_LEFT] * (1 - a[k + HEX_LEFT]) + d[k + HEX_RIGHT] * (1 - a[k + HEX_RIGHT]) +
+                          d[k + HEX_UP_RIGHT] * (1 - a[k + HEX_UP_RIGHT]) +
+                          d[k + HEX_DOWN_LEFT] * (1 - a[k + HEX_DOWN_LEFT]);
+                attach = (difmass <= theta);
             }
+            nb[k] = attach;
         }
     }
-    for (i = 1; i <= iup; i++)
+    for (n = 0; n < nseg; n++)
     {
-        for (j = 1; ((j <= i) && (i + j <= nr - 1)); j++)
+        i = g_order_segs[n].i;
+        for (j = g_order_segs[n].j0; j <= g_order_segs[n].j1; j++)
         {
 
             if (a_pic[i][j] != bpic[i][j])
             {
                 a_pic[i][j] = bpic[i][j];
+                if (g_order != ORDER_ROWS)
+                    g_order_crystal[i / ORDER_TILE][j / ORDER_TILE]++;
 
                 c__lm[i][j] += b__fr[i][j];
+                attached += mass_weight(i, j) * b__fr[i][j];
+                g_attached += (long)mass_weight(i, j);
                 b__fr[i][j] = 0.0;
                 k = norm_inf(i - g_center_i, j - g_center_j);
                 if (k > g_r_new)
                     g_r_new = k;
                 if (g_r_new > 2 * nr / 3)
+                {
                     g_stop = true;
+                    g_stop_reason = STOP_RADIUS;
+                }
                 ash[i][j] = g_par_ash;
                 g_is_fr_changed = true;
             }
         }
     }
+    g_mass_boundary -= attached;
+    g_mass_crystal += attached;
     g_par_update = 1 - g_par_update;
     if (g_r_new - g_r_old == 1)
     {
@@ -816,199 +2086,486 @@ void dynamics_attachment()
     createbdry();
 }
 
-void dynamics_freezing()
+/**
+ * The freezing of the boundary cells. `with_kappa` is a constant in the
+ * instances below: without it the whole vapor goes to b__fr and c__lm
+ * is not touched.
+ */
+static inline __attribute__((always_inline)) void dynamics_freezing_with(const int with_kappa)
 
 {
 
-    double x, y;
     int i, j, k;
-    int id, iu, jl, jr;
-    int part;
     int count;
     double offset;
-    double frmass;
-    double blockmass;
+    double w, frozen = 0.0, to_b = 0.0;
+    long frontier = 0;
 
-    int ilo, iup, jlo, jup;
-    double epsilon;
+    int iup;
+    int n, nseg;
+    const int *a = &a_pic[0][0];
+    double *d = &d_dif[0][0], *bf = &b__fr[0][0], *c = &c__lm[0][0];
 
     iup = g_center_i + g_r_new + 1;
     g_is_fr_changed = false;
 
-    for (i = 1; i <= iup; i++)
+    nseg = order_segments(iup);
+    for (n = 0; n < nseg; n++)
     {
-        for (j = 1; ((j <= i) && (i + j <= nr - 1)); j++)
+        i = g_order_segs[n].i;
+        for (j = g_order_segs[n].j0; j <= g_order_segs[n].j1; j++)
         {
-
-            if (a_pic[i][j] == 0)
+            k = HEX_INDEX(i, j);
+            if (a[k] == 0)
             {
-
-                id = i + 1;
-                iu = i - 1;
-                jr = j + 1;
-                jl = j - 1;
-                count = 0;
-                if (a_pic[id][j] == 1)
-                    count++;
-                if (a_pic[iu][j] == 1)
-                    count++;
-                if (a_pic[i][jl] == 1)
-                    count++;
-                if (a_pic[i][jr] == 1)
-                    count++;
-                if (a_pic[iu][jr] == 1)
-                    count++;
-                if (a_pic[id][jl] == 1)
-                    count++;
+                count = (a[k + HEX_DOWN] == 1) + (a[k + HEX_UP] == 1) + (a[k + HEX_LEFT] == 1) +
+                        (a[k + HEX_RIGHT] == 1) + (a[k + HEX_UP_RIGHT] == 1) + (a[k + HEX_DOWN_LEFT] == 1);
 
                 if (count >= 1)
                 {
-                    offset = (1.0 - kappa) * d_dif[i][j];
-                    b__fr[i][j] = b__fr[i][j] + offset;
-                    offset = d_dif[i][j] - offset;
-                    d_dif[i][j] = 0;
-                    c__lm[i][j] += offset;
+                    w = mass_weight(i, j);
+                    frontier += (long)w;
+                    frozen += w * d[k];
+                    if (with_kappa)
+                    {
+                        offset = (1.0 - kappa) * d[k];
+                        bf[k] = bf[k] + offset;
+                        to_b += w * offset;
+                        offset = d[k] - offset;
+                        d[k] = 0;
+                        c[k] += offset;
+                    }
+                    else
+                    {
+                        bf[k] = bf[k] + d[k];
+                        to_b += w * d[k];
+                        d[k] = 0;
+                    }
                 }
             }
         }
     }
+    g_mass_vapor -= frozen;
+    g_mass_boundary += to_b;
+    g_mass_crystal += frozen - to_b;
+    g_frontier = frontier;
     createbdry();
 }
 
-void dynamics()
+void dynamics_freezing()
+{
+    if (kappa != 0.0)
+        dynamics_freezing_with(1);
+    else
+        dynamics_freezing_with(0);
+}
 
+/**
+ * The physics a parameter set switches on. The step is compiled once per
+ * combination, so e.g. with kappa = mu = gam = sigma = 0 (examples/h2l-4.txt)
+ * there is no melting sweep and no kappa in the freezing at all.
+ */
+#define DYN_KAPPA 1 /* kappa != 0 */
+#define DYN_MELT 2  /* mu != 0 or gam != 0 */
+#define DYN_NOISE 4 /* sigma > 0 */
+#define DYN_VARIANTS 8
+
+static inline __attribute__((always_inline)) void dynamics_step(const int features)
 {
-    int i;
+    prof_mark step, m;
 
+    step = prof_begin();
+    m = prof_begin();
     dynamics_diffusion();
-    dynamics_freezing();
+    prof_end(PROF_DIFFUSION, &m);
+    m = prof_begin();
+    dynamics_freezing_with(features & DYN_KAPPA);
+    prof_end(PROF_FREEZING, &m);
+    m = prof_begin();
     dynamics_attachment();
-    dynamics_melting();
-
-    if (sigma > 0.0)
+    prof_end(PROF_ATTACHMENT, &m);
+    if (features & DYN_MELT)
+    {
+        m = prof_begin();
+        dynamics_melting();
+        prof_end(PROF_MELTING, &m);
+    }
+    if (features & DYN_NOISE)
+    {
+        m = prof_begin();
         dynamics_add_noise();
-
-    /*io_print_state(); */
+        prof_end(PROF_NOISE, &m);
+    }
+    prof_end(PROF_STEP, &step);
 }
 
-void gui_picture_big()
+void dynamics_step0() { dynamics_step(0); }
+void dynamics_step1() { dynamics_step(1); }
+void dynamics_step2() { dynamics_step(2); }
+void dynamics_step3() { dynamics_step(3); }
+void dynamics_step4() { dynamics_step(4); }
+void dynamics_step5() { dynamics_step(5); }
+void dynamics_step6() { dynamics_step(6); }
+void dynamics_step7() { dynamics_step(7); }
+
+void (*const dynamics_STEPS[DYN_VARIANTS])() = {dynamics_step0, dynamics_step1, dynamics_step2, dynamics_step3,
+                                                 dynamics_step4, dynamics_step5, dynamics_step6, dynamics_step7};
 
+/** the step for the parameters, chosen at the first step of a run */
+void (*g_dynamics_step)() = NULL;
+
+/** chooses the step for the current parameters */
+void dynamics_select()
 {
-    int i, j, k, pqn, kf;
+    int features = 0;
 
-    double y;
+    if (kappa != 0.0)
+        features |= DYN_KAPPA;
+    if ((mu != 0.0) || (gam != 0.0))
+        features |= DYN_MELT;
+    if (sigma > 0.0)
+        features |= DYN_NOISE;
+    g_dynamics_step = dynamics_STEPS[features];
+    printf(".dynamics_select: kappa %s, melting %s, noise %s\n", (features & DYN_KAPPA) ? "on" : "off",
+           (features & DYN_MELT) ? "on" : "off", (features & DYN_NOISE) ? "on" : "off");
+}
 
-    char pqc[10];
+void dynamics()
 
-    buildbig();
-    for (i = 1; i < nr; i++)
-    {
-        for (j = 1; j < nc; j++)
-        {
+{
+    if (g_dynamics_step == NULL)
+        dynamics_select();
+    g_dynamics_step();
 
-            if (a_pic[i][j] == 0)
-            {
+    /*io_print_state(); */
+}
 
-                k = floor(63.0 * (d_dif[i][j] / (init_gas_rho)));
-                XSetForeground(g_xDisplay, g_xGC, g_color_off[k].pixel);
-                XFillRectangle(g_xEvent.xexpose.display, g_xEvent.xexpose.window, g_xGC, j * sp + 30, i * sp + 60, sp, sp);
-            }
-            else
-            {
+void snapshot_alloc(snapshot *f)
+{
+    f->src.a_pic = malloc(nr * sizeof(a_pic[0]));
+    f->src.d_dif = malloc(nr * sizeof(d_dif[0]));
+    f->src.c__lm = malloc(nr * sizeof(c__lm[0]));
+    f->src.ash = malloc(nr * sizeof(ash[0]));
+}
 
-                y = c__lm[i][j] + d_dif[i][j];
+void snapshot_free(snapshot *f)
+{
+    free(f->src.a_pic);
+    free(f->src.d_dif);
+    free(f->src.c__lm);
+    free(f->src.ash);
+}
 
-                k = floor((33.0 * y - alpha) / (beta - alpha));
-                if (k > 32)
-                    k = 32;
+/** copies the live fields into `f` */
+void snapshot_take(snapshot *f)
+{
+    f->pq = g_pq;
+    f->r_new = g_r_new;
+    memcpy(f->src.a_pic, a_pic, nr * sizeof(a_pic[0]));
+    memcpy(f->src.d_dif, d_dif, nr * sizeof(d_dif[0]));
+    memcpy(f->src.c__lm, c__lm, nr * sizeof(c__lm[0]));
+    memcpy(f->src.ash, ash, nr * sizeof(ash[0]));
+}
 
-                XSetForeground(g_xDisplay, g_xGC, g_color_on[k].pixel);
-                XFillRectangle(g_xEvent.xexpose.display, g_xEvent.xexpose.window, g_xGC, j * sp + 30, i * sp + 60, sp, sp);
-            }
-        }
-    }
+/**
+ * (i, j) is a cell buildbig() would fill by reflecting the wedge,
+ * it has the color of (j, i).
+ */
+int render_is_mirrored(int i, int j)
+{
+    return (i >= 1) && (j > i) && (i + j <= nr);
+}
+
+/**
+ * Colors the cells j0..j1 of row i.
+ *
+ * The palette indices are computed for the whole run first, without
+ * branches (vectorized with -O3), with the divisions of the original
+ * floor(63 d / rho) and floor((33 y - alpha) / (beta - alpha)), so the
+ * colors are exactly those; they are clamped, so a vapor density above
+ * rho (noise) or a negative crystal index cannot read outside the
+ * palettes. Then each cell picks its palette. The conditions of the
+ * rings palette reduce to two thresholds since c > 1 + 0.5(beta-1) is
+ * given.
+ */
+void render_row(const render_src *src, const render_lut *lut, int i, int j0, int j1, int rings, XColor **out)
+{
+    int j, k;
+    int koff[NC_MAX], kon[NC_MAX];
+    double x;
+    const int *a = src->a_pic[i];
+    const double *d = src->d_dif[i];
+    const double *c = src->c__lm[i];
+    const int *ash_i = src->ash[i];
 
-    if (g_pq == 0)
+    for (j = j0; j <= j1; j++)
     {
-        pqc[0] = '0';
-        pqc[1] = '\0';
+        x = 63.0 * (d[j] / lut->rho);
+        koff[j] = (x < 0.0) ? 0 : ((x >= 63.0) ? 63 : (int)x);
+        x = (33.0 * (c[j] + d[j]) - lut->on_lo) / lut->on_range;
+        kon[j] = (x < 0.0) ? 0 : ((x >= 32.0) ? 32 : (int)x);
     }
-    else
+    for (j = j0; j <= j1; j++)
     {
-        pqn = g_pq;
-        for (k = 9; k >= 0; k--)
+        if (a[j] == 0)
+            out[j] = &g_color_off[koff[j]];
+        else if (rings == 0)
+            out[j] = &g_color_on[kon[j]];
+        else if (c[j] > lut->t50)
         {
-
-            pqc[k] = pqn % 10 + '0';
-            pqn = pqn / 10;
+            k = (c[j] >= beta) ? 15 : ((c[j] >= lut->t70) ? 14 : 13);
+            out[j] = &g_othp[k];
         }
-        for (kf = 0; pqc[kf] == '0'; kf++)
-            ;
+        else
+        {
+            out[j] = &g_color[ash_i[j] % KAPPA_MAX];
+        }
+    }
+}
 
-        for (k = 0; k <= 9 - kf; k++)
-            pqc[k] = pqc[k + kf];
-        pqc[10 - kf] = '\0';
+/**
+ * Colors the wedge (and the cells outside the reflected part) once.
+ * The reflected cells are never colored: render_color() looks them up
+ * in the wedge, so no buildbig() is needed before drawing.
+ */
+void render_wedge(const render_src *src, int rings, XColor *(*cells)[NC_MAX])
+{
+    int i, jup;
+    render_lut lut;
+
+    prof_mark m;
+
+    m = prof_begin();
+    lut.rho = init_gas_rho;
+    lut.on_lo = alpha;
+    lut.on_range = beta - alpha;
+    lut.t50 = 1 + 0.5 * (beta - 1.0);
+    lut.t70 = 1 + 0.7 * (beta - 1.0);
+
+    for (i = 0; i < nr; i++)
+    {
+        jup = (i >= 1) ? i : nc - 1;
+        render_row(src, &lut, i, 0, jup, rings, cells[i]);
+        if (nr - i + 1 > jup + 1)
+            render_row(src, &lut, i, nr - i + 1, nc - 1, rings, cells[i]);
+        else
+            render_row(src, &lut, i, jup + 1, nc - 1, rings, cells[i]);
     }
+    prof_end(PROF_RENDER, &m);
+}
 
-    XSetForeground(g_xDisplay, g_xGC, g_xBlack);
-    XSetBackground(g_xDisplay, g_xGC, g_xWhite);
+XColor *render_color(XColor *(*cells)[NC_MAX], int i, int j)
+{
+    if (render_is_mirrored(i, j))
+        return cells[j][i];
+    return cells[i][j];
+}
 
-    XDrawImageString(g_xEvent.xexpose.display, g_xEvent.xexpose.window, g_xGC, 10, 45, gui_TIME_STR, strlen(gui_TIME_STR));
-    XDrawImageString(g_xEvent.xexpose.display, g_xEvent.xexpose.window, g_xGC, 40, 45, pqc, strlen(pqc));
+int gui_shm_error_handler(Display *display, XErrorEvent *event)
+{
+    g_xShmError = 1;
+    return 0;
 }
 
-void gui_picture_rings()
+/**
+ * Creates the framebuffer for the (nr-1)x(nc-1) cells at zoom `sp`,
+ * in shared memory when the MIT-SHM extension works (local display).
+ */
+void gui_create_image()
+{
+    int w, h;
+    Visual *visual;
+    int depth;
+    int (*old_handler)(Display *, XErrorEvent *);
+
+    w = (nc - 1) * sp;
+    h = (nr - 1) * sp;
+    visual = DefaultVisual(g_xDisplay, g_xScreen);
+    depth = DefaultDepth(g_xDisplay, g_xScreen);
+
+    g_xUseShm = 0;
+    if (XShmQueryExtension(g_xDisplay))
+    {
+        g_xImage = XShmCreateImage(g_xDisplay, visual, depth, ZPixmap, NULL, &g_xShmInfo, w, h);
+        g_xShmInfo.shmid = shmget(IPC_PRIVATE, g_xImage->bytes_per_line * h, IPC_CREAT | 0600);
+        if (g_xShmInfo.shmid >= 0)
+        {
+            g_xShmInfo.shmaddr = g_xImage->data = shmat(g_xShmInfo.shmid, NULL, 0);
+            g_xShmInfo.readOnly = False;
+
+            // attaching fails on remote displays, catch the error
+            g_xShmError = 0;
+            old_handler = XSetErrorHandler(gui_shm_error_handler);
+            XShmAttach(g_xDisplay, &g_xShmInfo);
+            XSync(g_xDisplay, False);
+            XSetErrorHandler(old_handler);
+            shmctl(g_xShmInfo.shmid, IPC_RMID, NULL);
+
+            if (g_xShmError == 0)
+                g_xUseShm = 1;
+            else
+                shmdt(g_xShmInfo.shmaddr);
+        }
+        if (g_xUseShm == 0)
+        {
+            g_xImage->data = NULL;
+            XDestroyImage(g_xImage);
+        }
+    }
+    if (g_xUseShm == 0)
+    {
+        g_xImage = XCreateImage(g_xDisplay, visual, depth, ZPixmap, 0, NULL, w, h, 32, 0);
+        g_xImage->data = malloc(g_xImage->bytes_per_line * h);
+    }
+    printf(".gui_create_image: %dx%d framebuffer%s\n", w, h, g_xUseShm ? " (MIT-SHM)" : "");
+}
 
+void gui_destroy_image()
 {
-    int i, j, k, pqn, kf;
+    if (g_xUseShm)
+    {
+        XShmDetach(g_xDisplay, &g_xShmInfo);
+        shmdt(g_xShmInfo.shmaddr);
+        g_xImage->data = NULL;
+    }
+    XDestroyImage(g_xImage);
+}
 
-    char pqc[10];
+/** whether the image stores its pixels in the byte order of this host */
+int gui_native_order()
+{
+    const unsigned int one = 1;
 
-    buildbig();
+    return g_xImage->byte_order == ((*(const unsigned char *)&one == 1) ? LSBFirst : MSBFirst);
+}
+
+/**
+ * Fills the sp x sp block of cell (i, j). 32 bit pixels in the host's
+ * byte order are stored directly, anything else goes through XPutPixel().
+ */
+void gui_fill_cell(int i, int j, unsigned long pixel)
+{
+    int x, y, x0, y0;
+    unsigned int *p;
+
+    x0 = (j - 1) * sp;
+    y0 = (i - 1) * sp;
+    if ((g_xImage->bits_per_pixel == 32) && gui_native_order())
+    {
+        for (y = y0; y < y0 + sp; y++)
+        {
+            p = (unsigned int *)(g_xImage->data + y * g_xImage->bytes_per_line) + x0;
+            for (x = 0; x < sp; x++)
+                p[x] = pixel;
+        }
+    }
+    else
+    {
+        for (y = y0; y < y0 + sp; y++)
+            for (x = x0; x < x0 + sp; x++)
+                XPutPixel(g_xImage, x, y, pixel);
+    }
+}
+
+/** puts the cells [i0, i0+ni) x [j0, j0+nj) (0 is cell 1) of the framebuffer */
+void gui_put_image(int i0, int j0, int ni, int nj)
+{
+    int x, y, w, h;
+
+    x = j0 * sp;
+    y = i0 * sp;
+    w = nj * sp;
+    h = ni * sp;
+    if (x + w > g_xImage->width)
+        w = g_xImage->width - x;
+    if (y + h > g_xImage->height)
+        h = g_xImage->height - y;
+
+    if (g_xUseShm)
+        XShmPutImage(g_xDisplay, g_xWindow, g_xGC, g_xImage, x, y, x + sp + 30, y + sp + 60, w, h, False);
+    else
+        XPutImage(g_xDisplay, g_xWindow, g_xGC, g_xImage, x, y, x + sp + 30, y + sp + 60, w, h);
+}
+
+/** draws cell (i, j) into the framebuffer if its color changed */
+void gui_update_cell(int i, int j, XColor *c)
+{
+    if (g_gui_drawn[i][j] == c)
+        return;
+
+    g_gui_drawn[i][j] = c;
+    gui_fill_cell(i, j, c->pixel);
+    g_gui_dirty[(i - 1) / GUI_TILE][(j - 1) / GUI_TILE] = 1;
+}
+
+/**
+ * Draws the colors of the last render_wedge() into `g_gui_cells` to the window,
+ * each wedge cell together with its reflection.
+ *
+ * Only cells whose color changed since the last frame (attached cells and
+ * cells whose vapor crossed a palette step) are written, and only the
+ * tiles containing them are sent to the server.
+ */
+void gui_draw_cells()
+{
+    int i, j, ti, tj, tj0;
+
+    prof_mark m;
+
+    m = prof_begin();
     for (i = 1; i < nr; i++)
     {
         for (j = 1; j < nc; j++)
         {
+            if (render_is_mirrored(i, j))
+                continue;
 
-            if (a_pic[i][j] == 0)
-            {
+            gui_update_cell(i, j, g_gui_cells[i][j]);
+            if (render_is_mirrored(j, i))
+                gui_update_cell(j, i, g_gui_cells[i][j]);
+        }
+    }
 
-                k = floor(63.0 * (d_dif[i][j] / (init_gas_rho)));
-                XSetForeground(g_xDisplay, g_xGC, g_color_off[k].pixel);
-                XFillRectangle(g_xEvent.xexpose.display, g_xEvent.xexpose.window, g_xGC, j * sp + 30, i * sp + 60, sp, sp);
-            }
-            else
-            {
-                k = ash[i][j];
-                k = k % KAPPA_MAX;
-                XSetForeground(g_xDisplay, g_xGC, g_color[k].pixel);
-                XFillRectangle(g_xEvent.xexpose.display, g_xEvent.xexpose.window, g_xGC, j * sp + 30, i * sp + 60, sp, sp);
-                if (c__lm[i][j] > 1 + 0.5 * (beta - 1.0))
-                {
-                    if (c__lm[i][j] >= 1 + 0.2 * (beta - 1.0))
-                        k = 12;
-                    if (c__lm[i][j] >= 1 + 0.5 * (beta - 1.0))
-                        k = 13;
-                    if (c__lm[i][j] >= 1 + 0.7 * (beta - 1.0))
-                        k = 14;
-                    if (c__lm[i][j] >= beta)
-                        k = 15;
-
-                    XSetForeground(g_xDisplay, g_xGC, g_othp[k].pixel);
-                    XFillRectangle(g_xEvent.xexpose.display, g_xEvent.xexpose.window, g_xGC, j * sp + 30, i * sp + 60, sp, sp);
-                }
-            }
+    // one put per run of dirty tiles in a tile row
+    for (ti = 0; ti * GUI_TILE < nr - 1; ti++)
+    {
+        for (tj = 0; tj * GUI_TILE < nc - 1; tj++)
+        {
+            if (!g_gui_dirty[ti][tj] && !g_gui_full)
+                continue;
+
+            tj0 = tj;
+            while (((tj + 1) * GUI_TILE < nc - 1) && (g_gui_dirty[ti][tj + 1] || g_gui_full))
+                tj++;
+            gui_put_image(ti * GUI_TILE, tj0 * GUI_TILE, GUI_TILE, (tj - tj0 + 1) * GUI_TILE);
         }
     }
+    memset(g_gui_dirty, 0, sizeof(g_gui_dirty));
+    g_gui_full = 0;
+
+    if (g_xUseShm)
+    {
+        // the server reads the segment, wait before it is drawn into again
+        XSync(g_xDisplay, False);
+    }
+    prof_end(PROF_DRAW, &m);
+}
+
+void gui_draw_time(int pq)
+
+{
+    int k, pqn, kf;
 
-    if (g_pq == 0)
+    char pqc[10];
+
+    if (pq == 0)
     {
         pqc[0] = '0';
         pqc[1] = '\0';
     }
     else
     {
-        pqn = g_pq;
+        pqn = pq;
         for (k = 9; k >= 0; k--)
         {
 
@@ -1029,6 +2586,36 @@ void gui_picture_rings()
     XDrawImageString(g_xEvent.xexpose.display, g_xEvent.xexpose.window, g_xGC, 10, 45, gui_TIME_STR, strlen(gui_TIME_STR));
     XDrawImageString(g_xEvent.xexpose.display, g_xEvent.xexpose.window, g_xGC, 40, 45, pqc, strlen(pqc));
 }
+
+/** draws the snapshot the viewer holds, see gui_take_snapshot() */
+void gui_picture(int rings)
+
+{
+    snapshot *f = &g_snap[g_snap_front];
+
+    render_wedge(&f->src, rings, g_gui_cells);
+    gui_draw_cells();
+    gui_draw_time(f->pq);
+}
+
+void gui_picture_big()
+
+{
+    gui_picture(0);
+}
+
+void gui_picture_rings()
+
+{
+    gui_picture(1);
+}
+
+/** after [pause] even times are shown with the rings palette */
+void gui_picture_shown()
+
+{
+    gui_picture(g_gui_rings && (g_snap[g_snap_front].pq % 2 == 0));
+}
 void gui_draw_buttons()
 
 {
@@ -1037,6 +2624,8 @@ void gui_draw_buttons()
     char playstring[] = "play";
     char savestring[] = "save";
     char readstring[] = "read";
+    char *batchstrings[] = {"+10", "+100", "+1000", "r+10"};
+    int k;
 
     XSetForeground(g_xDisplay, g_xGC, g_xBlack);
     XSetBackground(g_xDisplay, g_xGC, g_xWhite);
@@ -1058,224 +2647,2814 @@ void gui_draw_buttons()
     XDrawImageString(g_xEvent.xexpose.display, g_xEvent.xexpose.window, g_xGC, 185, 25, savestring, strlen(savestring));
 
     XDrawImageString(g_xEvent.xexpose.display, g_xEvent.xexpose.window, g_xGC, 240, 25, readstring, strlen(readstring));
+
+    // batches: run 10, 100, 1000 steps, grow the radius by 10
+    for (k = 0; k < 4; k++)
+    {
+        XDrawRectangle(g_xEvent.xexpose.display, g_xEvent.xexpose.window, g_xGC, 120 + 55 * k, 32, 50, 16);
+        XDrawImageString(g_xEvent.xexpose.display, g_xEvent.xexpose.window, g_xGC, 130 + 55 * k, 45, batchstrings[k],
+                         strlen(batchstrings[k]));
+    }
 }
 
 void io_skip()
 
 {
-    char dum;
+    char dum;
+
+    dum = getchar();
+    while (dum != ':')
+        dum = getchar();
+}
+
+void io_read_state()
+
+{
+    int i, j, k;
+    double x;
+
+    prof_mark m;
+
+    m = prof_begin();
+    printf(".io_read_state: reading simulation state from file '%s'\n", g_in_file_path);
+    g_state_file = fopen(g_in_file_path, "r");
+
+    for (i = 0; i < nr; i++)
+    {
+        for (j = 0; j < nc; j++)
+        {
+            fscanf(g_state_file, "%lf", &x);
+            d_dif[i][j] = x;
+            fscanf(g_state_file, "%d", &k);
+            a_pic[i][j] = k;
+            fscanf(g_state_file, "%lf", &x);
+            b__fr[i][j] = x;
+            fscanf(g_state_file, "%d", &k);
+            ash[i][j] = k;
+            fscanf(g_state_file, "%lf", &x);
+            c__lm[i][j] = x;
+        }
+    }
+    fscanf(g_state_file, "%d", &k);
+    g_r_old = k;
+    fscanf(g_state_file, "%d", &k);
+    g_r_new = k;
+    fscanf(g_state_file, "%d", &k);
+    g_pq = k;
+
+    fclose(g_state_file);
+    printf(".io_read_state: File read finished.\n");
+    prof_end(PROF_IO, &m);
+}
+
+void io_save_state()
+
+{
+    int i, j;
+
+    prof_mark m;
+
+    m = prof_begin();
+    printf(".io_save_state: saving simulation state to file '%s'\n", g_out_file_path);
+    g_state_file = fopen(g_out_file_path, "w");
+
+    for (i = 0; i < nr; i++)
+    {
+        for (j = 0; j < nc; j++)
+        {
+            fprintf(g_state_file, "%.10lf %d %.10lf %d %.10lf ", d_dif[i][j], a_pic[i][j], b__fr[i][j], ash[i][j], c__lm[i][j]);
+        }
+    }
+    fprintf(g_state_file, "%d %d ", g_r_old, g_r_new);
+    fprintf(g_state_file, "%d ", g_pq);
+    fclose(g_state_file);
+    printf(".io_save_state: File written successfully.\n");
+    prof_end(PROF_IO, &m);
+}
+
+/** continues the FNV-1a hash `h` over `n` bytes */
+unsigned long long io_fnv(unsigned long long h, const void *data, size_t n)
+{
+    const unsigned char *p = data;
+    size_t k;
+
+    for (k = 0; k < n; k++)
+        h = (h ^ p[k]) * 1099511628211ULL;
+    return h;
+}
+
+#define IO_FNV_BASIS 14695981039346656037ULL
+
+/** FNV-1a hash of the fields and radii, equal states give equal sums */
+unsigned long long io_state_checksum()
+{
+    unsigned long long h = IO_FNV_BASIS;
+    int i;
+    int r[3];
+
+    for (i = 0; i < nr; i++)
+    {
+        h = io_fnv(h, d_dif[i], nc * sizeof(d_dif[i][0]));
+        h = io_fnv(h, a_pic[i], nc * sizeof(a_pic[i][0]));
+        h = io_fnv(h, b__fr[i], nc * sizeof(b__fr[i][0]));
+        h = io_fnv(h, c__lm[i], nc * sizeof(c__lm[i][0]));
+        h = io_fnv(h, ash[i], nc * sizeof(ash[i][0]));
+    }
+    r[0] = g_r_old;
+    r[1] = g_r_new;
+    r[2] = g_pq;
+    return io_fnv(h, r, sizeof(r));
+}
+
+/**
+ * takes (i,j) from 0 ... 2(nc-2)+1,
+ * outputs (i1,j1) in the 4th quadrant
+ *
+ * Closed form of the reflections/rotations of the hexagonal lattice,
+ * the result is the cell to read after buildbig().
+ */
+void io_image_cell(int i, int j, int *i1, int *j1)
+{
+    int x1, y1, n1;
+
+    n1 = nc - 2;
+    x1 = j - n1;
+    y1 = n1 - i;
+    if ((x1 < 0) || ((x1 == 0) && (y1 > 0)))
+    {
+        x1 = -x1;
+        y1 = -y1;
+    }
+    if (y1 > 0)
+    {
+        if (y1 <= x1)
+        {
+            *i1 = y1 + 1;
+            *j1 = x1 - y1 + 1;
+        }
+        else
+        {
+            *i1 = x1 + 1;
+            *j1 = y1 - x1 + 1;
+        }
+    }
+    else
+    {
+        *i1 = -y1 + 1;
+        *j1 = x1 + 1;
+    }
+}
+
+void io_color_rgb(XColor *c, unsigned char *rgb)
+{
+    rgb[0] = c->red * UCHAR_MAX / USHRT_MAX;
+    rgb[1] = c->green * UCHAR_MAX / USHRT_MAX;
+    rgb[2] = c->blue * UCHAR_MAX / USHRT_MAX;
+}
+
+/** picture formats of io_write_picture() */
+#define IO_PIC_P3   0
+#define IO_PIC_P6   1
+#define IO_PIC_RAW  2
+
+/** writes n pixels of `row` to the picture, backwards if dir < 0 */
+void io_write_row(FILE *f, unsigned char *row, int n, int dir, int format)
+{
+    int j, jj;
+    unsigned char rev[3 * 2 * NC_MAX];
+
+    if (format != IO_PIC_P3)
+    {
+        if (dir < 0)
+        {
+            for (j = 0; j < n; j++)
+                memcpy(rev + 3 * j, row + 3 * (n - 1 - j), 3);
+            row = rev;
+        }
+        fwrite(row, 3, n, f);
+        return;
+    }
+    for (j = 0; j < n; j++)
+    {
+        jj = (dir > 0) ? j : n - 1 - j;
+        fprintf(f, "%d %d %d ", row[3 * jj], row[3 * jj + 1], row[3 * jj + 2]);
+    }
+    fprintf(f, "\n");
+}
+
+/**
+ * Writes the pixels of the whole snowflake colored by render_wedge(),
+ * `rows` is scratch space for the upper half of the picture.
+ *
+ * Only the upper half of the picture is colored. The lower half is
+ * its point reflection, i.e. the same rows backwards in reverse order.
+ */
+void io_write_picture(FILE *f, XColor *(*cells)[NC_MAX], unsigned char (*rows)[3 * 2 * NC_MAX], int format)
+{
+    int i, j, i1, j1, n1;
+
+    prof_mark m;
+
+    m = prof_begin();
+    n1 = nc - 2;
+    for (i = 0; i <= n1; i++)
+    {
+        for (j = 0; j <= 2 * n1; j++)
+        {
+            io_image_cell(i, j, &i1, &j1);
+            io_color_rgb(render_color(cells, i1, j1), rows[i] + 3 * j);
+        }
+        io_write_row(f, rows[i], 2 * n1 + 1, 1, format);
+    }
+    for (i = n1 + 1; i <= 2 * n1; i++)
+        io_write_row(f, rows[2 * n1 - i], 2 * n1 + 1, -1, format);
+    prof_end(PROF_IO, &m);
+}
+
+void io_save_snowflake()
+
+{
+    /*  char g_grahics_viewer_name[30]="xv ";*/
+
+    /*char g_grahics_viewer_name[30]="gimp ";*/
+
+    FILE *dum;
+
+    printf(".io_save_snowflake: saving snowflake image to file '%s'\n", g_graphics_file_path);
+    g_state_file = fopen(g_graphics_file_path, "w");
+    fprintf(g_state_file, "P3\n");
+    fprintf(g_state_file, "#rho:%lf\n", init_gas_rho);
+    fprintf(g_state_file, "#h:%d\n", init_crystal_seed_radius);
+    fprintf(g_state_file, "#p:%lf\n", init_crystal_seed_probability);
+    fprintf(g_state_file, "#beta:%lf\n", beta);
+    fprintf(g_state_file, "#alpha:%lf\n", alpha);
+    fprintf(g_state_file, "#theta:%lf\n", theta);
+    fprintf(g_state_file, "#kappa:%lf\n", kappa);
+    fprintf(g_state_file, "#mu:%lf\n", mu);
+    fprintf(g_state_file, "#gam:%lf\n", gam);
+    fprintf(g_state_file, "#sigma:%lf\n", sigma);
+
+    fprintf(g_state_file, "#L:%d\n", nr);
+    fprintf(g_state_file, "#Z:%d\n", sp);
+
+    fprintf(g_state_file, "#: no : no : no \n");
+
+    fprintf(g_state_file, "#: %s\n", g_grahics_viewer_name);
+    fprintf(g_state_file, "#: %s\n", g_comments);
+
+    fprintf(g_state_file, "%d %d\n", 2 * (nc - 2) + 1, 2 * (nr - 2) + 1);
+    fprintf(g_state_file, "255\n");
+    printf("\n");
+
+    render_wedge(&g_live, g_pq % 2 == 0, g_cell_color);
+    io_write_picture(g_state_file, g_cell_color, g_img_rows, IO_PIC_P3);
+
+    fclose(g_state_file);
+    printf(".io_save_snowflake: File written successfully.\n");
+
+    if (g_headless)
+        return;
+    strcat(g_grahics_viewer_name, " ");
+    strcat(g_grahics_viewer_name, g_graphics_file_path);
+    dum = popen(g_grahics_viewer_name, "r");
+}
+
+/**
+ * Placement of the fields and the threads.
+ *
+ * The nodes and their CPUs are read from /sys/devices/system/node. With
+ * -pin the dynamics thread (the main thread when headless, else the
+ * simulation thread) runs on the first CPU of the list, the frame
+ * workers on the others in turn. The used rows of the fields are first
+ * touched from the CPU of the thread that sweeps them, so that the
+ * kernel puts their pages on its node; one thread sweeps all rows, a
+ * split of the rows among threads touches its bands with
+ * numa_touch_rows(). With -thp the fields are advised for transparent
+ * huge pages before that. numa_report() prints the choice and the
+ * nodes the pages ended up on.
+ */
+#define NUMA_PIN_MAX 64
+#define NUMA_NODES_MAX 64
+
+/** -pin CPUs, the dynamics thread first */
+int g_numa_pin[NUMA_PIN_MAX];
+int g_numa_npin;
+/** -thp */
+bool g_numa_thp;
+/** nodes found, node of each CPU (-1: none) */
+int g_numa_nodes;
+short g_numa_cpu_node[CPU_SETSIZE];
+/** frame workers pinned so far */
+atomic_int g_numa_workers;
+
+typedef struct
+{
+    const char *name;
+    void *base;
+    size_t row_bytes;
+} numa_field;
+
+numa_field g_numa_fields[] = {
+    {"d_dif", d_dif, sizeof(d_dif[0])},
+    {"a_pic", a_pic, sizeof(a_pic[0])},
+    {"b__fr", b__fr, sizeof(b__fr[0])},
+    {"c__lm", c__lm, sizeof(c__lm[0])},
+    {"ash", ash, sizeof(ash[0])},
+};
+#define NUMA_FIELDS (sizeof(g_numa_fields) / sizeof(g_numa_fields[0]))
+
+/**
+ * Parses a CPU list like "0-3,8,10-11" into `cpus`, returns the number
+ * of CPUs (at most `max`).
+ */
+int numa_parse_cpus(const char *s, int *cpus, int max)
+{
+    int n = 0, lo, hi;
+    char *end;
+
+    while ((*s != '\0') && (*s != '\n'))
+    {
+        lo = hi = strtol(s, &end, 10);
+        if (end == s)
+            break;
+        if (*end == '-')
+        {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+        }
+        for (; (lo <= hi) && (n < max); lo++)
+            cpus[n++] = lo;
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return n;
+}
+
+void numa_topology()
+{
+    char path[64], line[1024];
+    int cpus[CPU_SETSIZE];
+    int node, n, k;
+    FILE *f;
+
+    for (k = 0; k < CPU_SETSIZE; k++)
+        g_numa_cpu_node[k] = -1;
+    g_numa_nodes = 0;
+    for (node = 0; node < NUMA_NODES_MAX; node++)
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        f = fopen(path, "r");
+        if (f == NULL)
+            continue;
+        if (fgets(line, sizeof(line), f) != NULL)
+        {
+            n = numa_parse_cpus(line, cpus, CPU_SETSIZE);
+            for (k = 0; k < n; k++)
+                if ((cpus[k] >= 0) && (cpus[k] < CPU_SETSIZE))
+                    g_numa_cpu_node[cpus[k]] = node;
+        }
+        fclose(f);
+        g_numa_nodes++;
+    }
+}
+
+int numa_node_of(int cpu)
+{
+    return ((cpu >= 0) && (cpu < CPU_SETSIZE)) ? g_numa_cpu_node[cpu] : -1;
+}
+
+void numa_pin(int cpu)
+{
+    cpu_set_t set;
+    int err;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0)
+        fprintf(stderr, "pinning to cpu %d: %s\n", cpu, strerror(err));
+}
+
+/** Called by the thread that runs the dynamics. */
+void numa_pin_dynamics()
+{
+    if (g_numa_npin > 0)
+        numa_pin(g_numa_pin[0]);
+}
+
+/** Called by each frame worker, they share the CPUs after the first. */
+void numa_pin_worker()
+{
+    int k;
+
+    if (g_numa_npin < 2)
+        return;
+    k = atomic_fetch_add(&g_numa_workers, 1);
+    numa_pin(g_numa_pin[1 + k % (g_numa_npin - 1)]);
+}
+
+/**
+ * Writes rows [lo, hi) of the fields, from the calling thread. The
+ * fields are zero until initialize(), so this only places the pages.
+ */
+void numa_touch_rows(int lo, int hi)
+{
+    int f;
+
+    for (f = 0; f < NUMA_FIELDS; f++)
+        memset((char *)g_numa_fields[f].base + lo * g_numa_fields[f].row_bytes, 0,
+               (hi - lo) * g_numa_fields[f].row_bytes);
+}
+
+/**
+ * Counts the pages of rows [0, rows) of the fields per node with
+ * move_pages(2) (which moves nothing without target nodes); `count`
+ * has NUMA_NODES_MAX + 1 entries, the last for pages of no known node.
+ * Returns 0 if the kernel cannot tell.
+ */
+int numa_count_pages(int rows, long *count)
+{
+    enum { CHUNK = 512 };
+    void *pages[CHUNK];
+    int status[CHUNK];
+    long page = sysconf(_SC_PAGESIZE);
+    char *p, *end;
+    int f, n, k;
+
+    for (f = 0; f < NUMA_FIELDS; f++)
+    {
+        p = (char *)((uintptr_t)g_numa_fields[f].base & ~(uintptr_t)(page - 1));
+        end = (char *)g_numa_fields[f].base + rows * g_numa_fields[f].row_bytes;
+        while (p < end)
+        {
+            for (n = 0; (n < CHUNK) && (p < end); n++, p += page)
+                pages[n] = p;
+            if (syscall(SYS_move_pages, 0, n, pages, NULL, status, 0) != 0)
+                return 0;
+            for (k = 0; k < n; k++)
+                count[((status[k] >= 0) && (status[k] < NUMA_NODES_MAX)) ? status[k] : NUMA_NODES_MAX]++;
+        }
+    }
+    return 1;
+}
+
+/** AnonHugePages of the process in kB, -1 if unknown. */
+long numa_huge_kb()
+{
+    char line[256];
+    long kb = -1;
+    FILE *f;
+
+    f = fopen("/proc/self/smaps_rollup", "r");
+    if (f == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), f) != NULL)
+        if (sscanf(line, "AnonHugePages: %ld", &kb) == 1)
+            break;
+    fclose(f);
+    return kb;
+}
+
+void numa_report(int rows)
+{
+    long count[NUMA_NODES_MAX + 1] = {0};
+    int k, cpu;
+
+    printf(".numa_report: %d node(s)", g_numa_nodes);
+    if (g_numa_npin > 0)
+        printf(", dynamics on cpu %d (node %d)", g_numa_pin[0], numa_node_of(g_numa_pin[0]));
+    else
+    {
+        cpu = sched_getcpu();
+        printf(", dynamics not pinned (main on cpu %d, node %d)", cpu, numa_node_of(cpu));
+    }
+    if (g_numa_npin > 1)
+    {
+        printf(", frame workers on cpu");
+        for (k = 1; k < g_numa_npin; k++)
+            printf("%s%d", (k == 1) ? " " : ",", g_numa_pin[k]);
+    }
+    if (g_numa_thp)
+        printf(", huge pages advised (%ld kB in use)", numa_huge_kb());
+    if (numa_count_pages(rows, count))
+    {
+        printf(", pages of the fields:");
+        for (k = 0; k < NUMA_NODES_MAX; k++)
+            if (count[k] > 0)
+                printf(" node%d %ld", k, count[k]);
+        if (count[NUMA_NODES_MAX] > 0)
+            printf(" unplaced %ld", count[NUMA_NODES_MAX]);
+    }
+    else
+        printf(", page placement unknown");
+    printf("\n");
+}
+
+/**
+ * Before initialize(): advise, first touch from the dynamics CPU and
+ * report. When headless the main thread is the dynamics thread and
+ * stays pinned; otherwise it gets its CPUs back.
+ */
+void numa_start()
+{
+    long page = sysconf(_SC_PAGESIZE);
+    int rows = (nr + 2 < NR_MAX) ? nr + 2 : NR_MAX;
+    cpu_set_t saved;
+    uintptr_t lo, hi;
+    int f;
+
+    numa_topology();
+    if (g_numa_thp)
+        for (f = 0; f < NUMA_FIELDS; f++)
+        {
+            lo = ((uintptr_t)g_numa_fields[f].base + page - 1) & ~(uintptr_t)(page - 1);
+            hi = ((uintptr_t)g_numa_fields[f].base + NR_MAX * g_numa_fields[f].row_bytes) & ~(uintptr_t)(page - 1);
+            if ((hi > lo) && (madvise((void *)lo, hi - lo, MADV_HUGEPAGE) != 0))
+                fprintf(stderr, "madvise %s: %s\n", g_numa_fields[f].name, strerror(errno));
+        }
+    if (g_numa_npin > 0)
+    {
+        pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved);
+        numa_pin_dynamics();
+    }
+    numa_touch_rows(0, rows);
+    if ((g_numa_npin > 0) && !g_headless)
+        pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+    numa_report(rows);
+}
+
+/**
+ * Time-lapse frames.
+ *
+ * Every `g_frames_every` steps (or whenever `g_r_new` grew by
+ * `g_frames_every_r`) the simulation copies the fields into a slot of a
+ * worker's ring and goes on. The workers color and write the pictures,
+ * so the simulation only waits when all slots of a ring are still busy.
+ * Each ring has a single producer (the simulation) and a single consumer
+ * (its worker), the slots are handed over with the atomic head/tail.
+ */
+void io_frames_write(frames_worker *w, snapshot *f)
+{
+    char path[MAX_IO_PATH_LEN + 32];
+    FILE *out;
+
+    render_wedge(&f->src, g_frames_rings, w->cells);
+    if (g_frames_stream != NULL)
+    {
+        io_write_picture(g_frames_stream, w->cells, w->rows, IO_PIC_RAW);
+        fflush(g_frames_stream);
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s%06d.ppm", g_frames_path, f->number);
+    out = fopen(path, "wb");
+    if (out == NULL)
+    {
+        fprintf(stderr, ".io_frames_write: cannot open '%s'\n", path);
+        return;
+    }
+    fprintf(out, "P6\n");
+    fprintf(out, "#time:%d\n", f->pq);
+    fprintf(out, "%d %d\n", 2 * (nc - 2) + 1, 2 * (nr - 2) + 1);
+    fprintf(out, "255\n");
+    io_write_picture(out, w->cells, w->rows, IO_PIC_P6);
+    fclose(out);
+}
+
+void *io_frames_worker(void *arg)
+{
+    frames_worker *w = arg;
+    unsigned int head;
+
+    trace_thread("frames");
+    numa_pin_worker();
+    for (;;)
+    {
+        head = atomic_load_explicit(&w->head, memory_order_relaxed);
+        if (head == atomic_load_explicit(&w->tail, memory_order_acquire))
+        {
+            // `g_frames_done` is set after the last push, so recheck the tail
+            if (atomic_load(&g_frames_done) && (head == atomic_load(&w->tail)))
+                break;
+            sleep_ms(1);
+            continue;
+        }
+
+        io_frames_write(w, &w->ring[head % FRAMES_RING]);
+        atomic_store_explicit(&w->head, head + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+void io_frames_push()
+{
+    frames_worker *w;
+    snapshot *f;
+    unsigned int tail;
+
+    w = &g_frames_w[g_frames_count % g_frames_workers];
+    tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+    while (tail - atomic_load_explicit(&w->head, memory_order_acquire) >= FRAMES_RING)
+    {
+        g_frames_stalls++;
+        sleep_ms(1);
+    }
+
+    f = &w->ring[tail % FRAMES_RING];
+    snapshot_take(f);
+    f->number = g_frames_count++;
+    g_frames_last_r = g_r_new;
+
+    atomic_store_explicit(&w->tail, tail + 1, memory_order_release);
+}
+
+/** called after every step, pushes a frame when one is due */
+void io_frames_check()
+{
+    if (g_frames_w == NULL)
+        return;
+
+    if ((g_frames_every > 0) && (g_pq % g_frames_every == 0))
+        io_frames_push();
+    else if ((g_frames_every_r > 0) && (g_r_new >= g_frames_last_r + g_frames_every_r))
+        io_frames_push();
+}
+
+void io_frames_start()
+{
+    int k, n;
+    frames_worker *w;
+
+    if ((g_frames_every <= 0) && (g_frames_every_r <= 0))
+        return;
+
+    if (g_frames_path[0] == '\0')
+        snprintf(g_frames_path, MAX_IO_PATH_LEN, "%.*s-", MAX_IO_PATH_LEN - 2, g_out_file_path);
+    if (g_frames_stream != NULL)
+        g_frames_workers = 1;
+    if (g_frames_workers < 1)
+        g_frames_workers = 1;
+    if (g_frames_workers > FRAMES_MAX_WORKERS)
+        g_frames_workers = FRAMES_MAX_WORKERS;
+
+    printf(".io_frames_start: a frame every %d steps / %d rows of growth, %d workers, output '%s'\n",
+           g_frames_every, g_frames_every_r, g_frames_workers, g_frames_path);
+
+    g_frames_w = calloc(g_frames_workers, sizeof(frames_worker));
+    for (k = 0; k < g_frames_workers; k++)
+    {
+        w = &g_frames_w[k];
+        atomic_init(&w->head, 0);
+        atomic_init(&w->tail, 0);
+        w->cells = malloc(nr * sizeof(*w->cells));
+        w->rows = malloc(nr * sizeof(*w->rows));
+        for (n = 0; n < FRAMES_RING; n++)
+            snapshot_alloc(&w->ring[n]);
+    }
+    g_frames_count = 0;
+    g_frames_stalls = 0;
+    atomic_init(&g_frames_done, 0);
+    for (k = 0; k < g_frames_workers; k++)
+        pthread_create(&g_frames_w[k].thread, NULL, io_frames_worker, &g_frames_w[k]);
+
+    io_frames_push();
+}
+
+void io_frames_finish()
+{
+    int k, n;
+    frames_worker *w;
+
+    if (g_frames_w == NULL)
+        return;
+
+    atomic_store(&g_frames_done, 1);
+    for (k = 0; k < g_frames_workers; k++)
+    {
+        w = &g_frames_w[k];
+        pthread_join(w->thread, NULL);
+        for (n = 0; n < FRAMES_RING; n++)
+            snapshot_free(&w->ring[n]);
+        free(w->cells);
+        free(w->rows);
+    }
+    free(g_frames_w);
+    g_frames_w = NULL;
+    if (g_frames_stream != NULL)
+        fclose(g_frames_stream);
+
+    printf(".io_frames_finish: %d frames written, simulation waited %ld times for a free slot\n",
+           g_frames_count, g_frames_stalls);
+}
+
+/**
+ * Golden trajectories.
+ *
+ * -golden-record FILE runs headless and writes, after every step (and for
+ * the initial state), the FNV-1a checksum of each field, and every
+ * -golden-every steps (and at the end) a keyframe with the fields
+ * themselves. -golden-check FILE reruns the same parameters and seed and
+ * compares step by step:
+ *
+ *   bit-exact (default)  the first step whose checksums differ is
+ *                        reported with the fields, the next keyframe
+ *                        gives the first differing cell of each field
+ *   -golden-tol T        keyframes only, fields may differ by T (or
+ *                        per field, d_dif=T,b__fr=T,c__lm=T; the integer
+ *                        fields a_pic and ash always exactly)
+ *
+ * The fields are compared over the cells j <= i, i.e. the 1/12 wedge the
+ * dynamics update plus its mirrored boundary. A failed check ends the run
+ * with exit status 1.
+ */
+void golden_field(int f, int i, void **row, size_t *size)
+{
+    switch (f)
+    {
+    case 0:
+        *row = d_dif[i];
+        *size = sizeof(d_dif[i][0]);
+        break;
+    case 1:
+        *row = a_pic[i];
+        *size = sizeof(a_pic[i][0]);
+        break;
+    case 2:
+        *row = b__fr[i];
+        *size = sizeof(b__fr[i][0]);
+        break;
+    case 3:
+        *row = c__lm[i];
+        *size = sizeof(c__lm[i][0]);
+        break;
+    default:
+        *row = ash[i];
+        *size = sizeof(ash[i][0]);
+        break;
+    }
+}
+
+/** cells of row i that are compared */
+int golden_row_len(int i)
+{
+    return (i + 1 < nc) ? i + 1 : nc;
+}
+
+void golden_sums(unsigned long long *sums)
+{
+    void *row;
+    size_t size;
+    int f, i;
+
+    for (f = 0; f < GOLDEN_FIELDS; f++)
+    {
+        sums[f] = IO_FNV_BASIS;
+        for (i = 0; i < nr; i++)
+        {
+            golden_field(f, i, &row, &size);
+            sums[f] = io_fnv(sums[f], row, golden_row_len(i) * size);
+        }
+    }
+}
+
+void golden_header_fill(golden_header *h)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, "SNOWGLD1", 8);
+    h->nr = nr;
+    h->nc = nc;
+    h->seed = g_seed;
+    h->h = init_crystal_seed_radius;
+    h->twelve = twelve_sided;
+    h->par[0] = init_gas_rho;
+    h->par[1] = init_crystal_seed_probability;
+    h->par[2] = beta;
+    h->par[3] = alpha;
+    h->par[4] = theta;
+    h->par[5] = kappa;
+    h->par[6] = mu;
+    h->par[7] = gam;
+    h->par[8] = sigma;
+}
+
+void golden_write_key()
+{
+    void *row;
+    size_t size;
+    int f, i, tag = GOLDEN_KEY;
+
+    fwrite(&tag, sizeof(tag), 1, g_golden_file);
+    fwrite(&g_pq, sizeof(g_pq), 1, g_golden_file);
+    for (f = 0; f < GOLDEN_FIELDS; f++)
+    {
+        for (i = 0; i < nr; i++)
+        {
+            golden_field(f, i, &row, &size);
+            fwrite(row, size, golden_row_len(i), g_golden_file);
+        }
+    }
+}
+
+void golden_read_tag()
+{
+    if ((fread(&g_golden_tag, sizeof(g_golden_tag), 1, g_golden_file) != 1) ||
+        (fread(&g_golden_step, sizeof(g_golden_step), 1, g_golden_file) != 1))
+        g_golden_tag = 0;
+}
+
+/** compares a keyframe of the reference with the state */
+void golden_check_key()
+{
+    char ref[NC_MAX * sizeof(double)];
+    void *row;
+    size_t size;
+    double x, y, d, dmax;
+    int f, i, j, n, bad, first_i, first_j;
+
+    for (f = 0; f < GOLDEN_FIELDS; f++)
+    {
+        bad = 0;
+        dmax = 0.0;
+        first_i = first_j = -1;
+        for (i = 0; i < nr; i++)
+        {
+            golden_field(f, i, &row, &size);
+            n = golden_row_len(i);
+            if (fread(ref, size, n, g_golden_file) != (size_t)n)
+            {
+                printf(".golden: keyframe of step %d is truncated\n", g_pq);
+                g_golden_failed = 1;
+                return;
+            }
+            for (j = 0; j < n; j++)
+            {
+                if (size == sizeof(double))
+                {
+                    memcpy(&x, ref + j * size, size);
+                    y = ((double *)row)[j];
+                }
+                else
+                {
+                    x = ((int *)ref)[j];
+                    y = ((int *)row)[j];
+                }
+                if (memcmp(ref + j * size, (char *)row + j * size, size) == 0)
+                    continue;
+                d = fabs(x - y);
+                if (g_golden_tolerant && (size == sizeof(double)) && (d <= g_golden_tol[f]))
+                    continue;
+                if (bad++ == 0)
+                {
+                    first_i = i;
+                    first_j = j;
+                }
+                if (!(d <= dmax))
+                    dmax = d;
+            }
+        }
+        if (bad > 0)
+        {
+            printf(".golden: step %d, %s differs in %d cells, first at (%d,%d), max difference %g\n", g_pq,
+                   golden_NAMES[f], bad, first_i, first_j, dmax);
+            g_golden_failed = 1;
+        }
+    }
+}
+
+/**
+ * Records or checks the state after a step, returns 0 when the run
+ * should end (the reference ends or differs for good).
+ */
+int golden_step()
+{
+    unsigned long long sums[GOLDEN_FIELDS], ref[GOLDEN_FIELDS];
+    int f, tag = GOLDEN_SUMS;
+
+    if (!g_golden)
+        return 1;
+
+    golden_sums(sums);
+    if (g_golden == GOLDEN_RECORD)
+    {
+        fwrite(&tag, sizeof(tag), 1, g_golden_file);
+        fwrite(&g_pq, sizeof(g_pq), 1, g_golden_file);
+        fwrite(sums, sizeof(sums[0]), GOLDEN_FIELDS, g_golden_file);
+        if ((g_golden_every > 0) && (g_pq % g_golden_every == 0))
+            golden_write_key();
+        return 1;
+    }
+
+    if ((g_golden_tag != GOLDEN_SUMS) || (g_golden_step != g_pq))
+    {
+        printf(".golden: the reference ends before step %d\n", g_pq);
+        return 0;
+    }
+    fread(ref, sizeof(ref[0]), GOLDEN_FIELDS, g_golden_file);
+    g_golden_last = g_pq;
+    if (!g_golden_tolerant && (g_golden_diverged < 0))
+    {
+        for (f = 0; f < GOLDEN_FIELDS; f++)
+        {
+            if (sums[f] == ref[f])
+                continue;
+            if (g_golden_diverged < 0)
+                printf(".golden: first divergence at step %d:", g_pq);
+            g_golden_diverged = g_pq;
+            printf(" %s", golden_NAMES[f]);
+        }
+        if (g_golden_diverged >= 0)
+            printf("\n");
+    }
+
+    golden_read_tag();
+    if ((g_golden_tag == GOLDEN_KEY) && (g_golden_step == g_pq))
+    {
+        golden_check_key();
+        golden_read_tag();
+        // the cells of the first divergence are known now
+        if (g_golden_failed || (g_golden_diverged >= 0))
+        {
+            g_golden_failed = 1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/** opens the reference (-golden-check) or the record, before the first step */
+void golden_start()
+{
+    golden_header h, ref;
+    int f;
+
+    if (!g_golden)
+        return;
+
+    golden_header_fill(&h);
+    g_golden_file = fopen(g_golden_path, (g_golden == GOLDEN_RECORD) ? "wb" : "rb");
+    if (g_golden_file == NULL)
+    {
+        fprintf(stderr, ".golden_start: cannot open '%s'\n", g_golden_path);
+        exit(1);
+    }
+    if (g_golden == GOLDEN_RECORD)
+    {
+        if (g_seed < 0)
+            printf(".golden_start: warning, no -seed, the trajectory depends on the clock\n");
+        fwrite(&h, sizeof(h), 1, g_golden_file);
+        golden_step();
+        return;
+    }
+
+    if ((fread(&ref, sizeof(ref), 1, g_golden_file) != 1) || (memcmp(ref.magic, h.magic, 8) != 0))
+    {
+        fprintf(stderr, ".golden_start: '%s' is no golden trajectory\n", g_golden_path);
+        exit(1);
+    }
+    if (memcmp(&ref, &h, sizeof(h)) != 0)
+    {
+        // the run would diverge anyway, say why
+        printf(".golden_start: warning, parameters, size or seed differ from the reference (L %d, seed %d)\n", ref.nr,
+               ref.seed);
+        if ((ref.nr != nr) || (ref.nc != nc))
+            exit(1);
+    }
+    for (f = 0; f < GOLDEN_FIELDS; f++)
+        if (g_golden_tol[f] > 0.0)
+            g_golden_tolerant = 1;
+    golden_read_tag();
+    golden_step();
+}
+
+/** the last keyframe (record), the verdict (check) */
+void golden_finish()
+{
+    if (!g_golden)
+        return;
+
+    if (g_golden == GOLDEN_RECORD)
+    {
+        if ((g_golden_every <= 0) || (g_pq % g_golden_every != 0))
+            golden_write_key();
+        fclose(g_golden_file);
+        printf(".golden: %d steps recorded to '%s'\n", g_pq, g_golden_path);
+        return;
+    }
+
+    // a keyframe of the last step is still to compare
+    if ((g_golden_tag == GOLDEN_KEY) && (g_golden_step == g_pq))
+        golden_check_key();
+    if (g_golden_diverged >= 0)
+        g_golden_failed = 1;
+    fclose(g_golden_file);
+    printf(".golden: %s up to step %d\n", g_golden_failed ? "FAILED" : "matches the reference", g_golden_last);
+    exit(g_golden_failed ? 1 : 0);
+}
+
+/** parses -golden-tol: T for all fields, or name=T,... */
+void golden_parse_tol(char *arg)
+{
+    char *tok, *eq, *saveptr;
+    int f;
+
+    for (tok = strtok_r(arg, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr))
+    {
+        eq = strchr(tok, '=');
+        if (eq == NULL)
+        {
+            for (f = 0; f < GOLDEN_FIELDS; f++)
+                g_golden_tol[f] = atof(tok);
+            continue;
+        }
+        *eq = '\0';
+        for (f = 0; f < GOLDEN_FIELDS; f++)
+            if (strcmp(tok, golden_NAMES[f]) == 0)
+                g_golden_tol[f] = atof(eq + 1);
+    }
+}
+
+/**
+ * Command line options, the parameters themselves are read from stdin.
+ *
+ *   -headless           run without display until g_stop (or -steps)
+ *   -steps N            stop after N steps
+ *   -stop-radius R      stop when the radius reached R
+ *   -stop-idle K        stop when no cell attached for K steps
+ *   -stop-vapor TOL     stop when the vapor changed less than TOL in a step
+ *   -stop-mass TOL      stop when the mass shares moved less than TOL
+ *   -stop-window N      ... over N steps (100)
+ *   -stop-seconds S     stop after S seconds
+ *   -seed N             seed of the random numbers (default: the clock)
+ *   -tile-steps T       diffusion of the far field T steps at a time, see
+ *                       tile_begin()
+ *   -tile-rows H        ... in tiles of H rows (32)
+ *   -order rows|morton|hilbert  order of the cells for freezing and
+ *                       attachment, see order_segments()
+ *   -mass-audit N       recount the mass every N steps, see mass_check()
+ *   -obs FILE           observables as CSV, see obs_start()
+ *   -obs-every N        a line every N steps (10)
+ *   -golden-record FILE record a golden trajectory (headless), see golden_start()
+ *   -golden-check FILE  compare the run with a golden trajectory
+ *   -golden-every N     keyframe every N steps (250)
+ *   -golden-tol T       tolerance of the double fields, or d_dif=T,...
+ *   -frames N           write a frame every N steps
+ *   -frames-r R         write a frame whenever the radius grew by R
+ *   -frames-out PREFIX  frames are PREFIX000000.ppm ..., "-" streams raw
+ *                       rgb to stdout (e.g. for ffmpeg -f rawvideo)
+ *   -frames-workers W   number of threads writing frames
+ *   -frames-rings       color the frames with the rings palette
+ *   -prof FILE          time the phases, summary at exit, counters to
+ *                       FILE as JSON lines ("-" for the summary only)
+ *   -prof-every N       write the counters every N steps (1000)
+ *   -prof-hw            with -prof, count cycles, instructions and last
+ *                       level cache misses of the phases (perf_event_open)
+ *   -trace FILE         record the phases, saves and window events and
+ *                       write them to FILE as Chrome trace-event JSON at
+ *                       exit or on SIGUSR1
+ *   -trace-events N     keep the last N events (1048576)
+ *   -ensemble FILE      run the parameter sets of FILE in the lanes of
+ *                       vectors (headless), see run_ensemble()
+ *   -ensemble-threads W ... on W threads (1)
+ *   -ensemble-journal FILE  append the finished sets to FILE, skip
+ *                       those already in it
+ *   -ensemble-progress S    the sets done every S seconds (10, 0: off)
+ *   -pin CPU,...        run the dynamics on the first CPU (e.g. 0,2-4), the
+ *                       frame workers on the others, see numa_start(); the
+ *                       threads of -ensemble-threads on one each in turn
+ *   -thp                transparent huge pages for the fields
+ *   -bench FILE         time the kernels in isolation, results to FILE
+ *                       as JSON, see run_bench()
+ *   -bench-sizes L,...  grid sizes (100,250,500,1000,4000)
+ *   -bench-ms N         time each kernel for at least N ms (200)
+ *   -bench-steps N      steps of the dynamics for the grown state (200)
+ */
+void io_parse_args(int argc, char *argv[])
+{
+    int k;
+
+    for (k = 1; k < argc; k++)
+    {
+        if (strcmp(argv[k], "-headless") == 0)
+            g_headless = true;
+        else if ((strcmp(argv[k], "-steps") == 0) && (k + 1 < argc))
+            g_max_steps = atoi(argv[++k]);
+        else if ((strcmp(argv[k], "-seed") == 0) && (k + 1 < argc))
+            g_seed = atoi(argv[++k]);
+        else if ((strcmp(argv[k], "-tile-steps") == 0) && (k + 1 < argc))
+            g_tile_steps = atoi(argv[++k]);
+        else if ((strcmp(argv[k], "-tile-rows") == 0) && (k + 1 < argc))
+            g_tile_rows = atoi(argv[++k]);
+        else if ((strcmp(argv[k], "-order") == 0) && (k + 1 < argc))
+        {
+            k++;
+            for (g_order = ORDER_HILBERT; g_order > ORDER_ROWS; g_order--)
+                if (strcmp(argv[k], order_NAMES[g_order]) == 0)
+                    break;
+            if ((g_order == ORDER_ROWS) && (strcmp(argv[k], "rows") != 0))
+                fprintf(stderr, "unknown order '%s'\n", argv[k]);
+        }
+        else if ((strcmp(argv[k], "-ensemble") == 0) && (k + 1 < argc))
+        {
+            snprintf(g_ens_path, MAX_IO_PATH_LEN, "%s", argv[++k]);
+            g_headless = true;
+        }
+        else if ((strcmp(argv[k], "-ensemble-threads") == 0) && (k + 1 < argc))
+            g_ens_threads = atoi(argv[++k]);
+        else if ((strcmp(argv[k], "-ensemble-journal") == 0) && (k + 1 < argc))
+            snprintf(g_ens_journal_path, MAX_IO_PATH_LEN, "%s", argv[++k]);
+        else if ((strcmp(argv[k], "-ensemble-progress") == 0) && (k + 1 < argc))
+            g_ens_progress = atof(argv[++k]);
+        else if ((strcmp(argv[k], "-pin") == 0) && (k + 1 < argc))
+            g_numa_npin = numa_parse_cpus(argv[++k], g_numa_pin, NUMA_PIN_MAX);
+        else if (strcmp(argv[k], "-thp") == 0)
+            g_numa_thp = true;
+        else if ((strcmp(argv[k], "-mass-audit") == 0) && (k + 1 < argc))
+            g_mass_audit_every = atoi(argv[++k]);
+        else if ((strcmp(argv[k], "-stop-radius") == 0) && (k + 1 < argc))
+            g_stop_radius = atoi(argv[++k]);
+        else if ((strcmp(argv[k], "-stop-idle") == 0) && (k + 1 < argc))
+            g_stop_idle = atoi(argv[++k]);
+        else if ((strcmp(argv[k], "-stop-vapor") == 0) && (k + 1 < argc))
+            g_stop_vapor = atof(argv[++k]);
+        else if ((strcmp(argv[k], "-stop-mass") == 0) && (k + 1 < argc))
+            g_stop_mass = atof(argv[++k]);
+        else if ((strcmp(argv[k], "-stop-window") == 0) && (k + 1 < argc))
+            g_stop_window = atoi(argv[++k]);
+        else if ((strcmp(argv[k], "-stop-seconds") == 0) && (k + 1 < argc))
+            g_stop_seconds = atof(argv[++k]);
+        else if ((strcmp(argv[k], "-obs") == 0) && (k + 1 < argc))
+            snprintf(g_obs_path, MAX_IO_PATH_LEN, "%s", argv[++k]);
+        else if ((strcmp(argv[k], "-obs-every") == 0) && (k + 1 < argc))
+            g_obs_every = atoi(argv[++k]);
+        else if ((strcmp(argv[k], "-golden-record") == 0) && (k + 1 < argc))
+        {
+            g_golden = GOLDEN_RECORD;
+            g_headless = true;
+            snprintf(g_golden_path, MAX_IO_PATH_LEN, "%s", argv[++k]);
+        }
+        else if ((strcmp(argv[k], "-golden-check") == 0) && (k + 1 < argc))
+        {
+            g_golden = GOLDEN_CHECK;
+            g_headless = true;
+            snprintf(g_golden_path, MAX_IO_PATH_LEN, "%s", argv[++k]);
+        }
+        else if ((strcmp(argv[k], "-golden-every") == 0) && (k + 1 < argc))
+            g_golden_every = atoi(argv[++k]);
+        else if ((strcmp(argv[k], "-golden-tol") == 0) && (k + 1 < argc))
+            golden_parse_tol(argv[++k]);
+        else if ((strcmp(argv[k], "-frames") == 0) && (k + 1 < argc))
+            g_frames_every = atoi(argv[++k]);
+        else if ((strcmp(argv[k], "-frames-r") == 0) && (k + 1 < argc))
+            g_frames_every_r = atoi(argv[++k]);
+        else if ((strcmp(argv[k], "-frames-out") == 0) && (k + 1 < argc))
+            snprintf(g_frames_path, MAX_IO_PATH_LEN, "%s", argv[++k]);
+        else if ((strcmp(argv[k], "-frames-workers") == 0) && (k + 1 < argc))
+            g_frames_workers = atoi(argv[++k]);
+        else if (strcmp(argv[k], "-frames-rings") == 0)
+            g_frames_rings = 1;
+        else if ((strcmp(argv[k], "-prof") == 0) && (k + 1 < argc))
+        {
+            g_prof = 1;
+            snprintf(g_prof_path, MAX_IO_PATH_LEN, "%s", argv[++k]);
+        }
+        else if ((strcmp(argv[k], "-prof-every") == 0) && (k + 1 < argc))
+            g_prof_every = atoi(argv[++k]);
+        else if (strcmp(argv[k], "-prof-hw") == 0)
+            g_prof_hw = 1;
+        else if ((strcmp(argv[k], "-bench") == 0) && (k + 1 < argc))
+            snprintf(g_bench_path, MAX_IO_PATH_LEN, "%s", argv[++k]);
+        else if ((strcmp(argv[k], "-bench-sizes") == 0) && (k + 1 < argc))
+            snprintf(g_bench_sizes, MAX_IO_PATH_LEN, "%s", argv[++k]);
+        else if ((strcmp(argv[k], "-bench-ms") == 0) && (k + 1 < argc))
+            g_bench_ms = atoi(argv[++k]);
+        else if ((strcmp(argv[k], "-bench-steps") == 0) && (k + 1 < argc))
+            g_bench_steps = atoi(argv[++k]);
+        else if ((strcmp(argv[k], "-trace") == 0) && (k + 1 < argc))
+        {
+            g_trace = 1;
+            snprintf(g_trace_path, MAX_IO_PATH_LEN, "%s", argv[++k]);
+        }
+        else if ((strcmp(argv[k], "-trace-events") == 0) && (k + 1 < argc))
+            g_trace_size = atol(argv[++k]);
+        else
+            fprintf(stderr, "unknown option '%s'\n", argv[k]);
+    }
+
+    if (strcmp(g_frames_path, "-") == 0)
+    {
+        // the frames own stdout, the messages (and prompts) go to stderr
+        g_frames_stream = fdopen(dup(STDOUT_FILENO), "wb");
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+}
+
+/**
+ * Temporally tiled diffusion (-tile-steps T).
+ *
+ * Far from the crystal a step is the diffusion alone, and there it is the
+ * same stencil for every cell. The steps are run in blocks of T: the
+ * dynamics do the rows up to g_tile_N (the crystal can grow by a row per
+ * step, so it stays below) and a halo that shrinks by a row per step, and
+ * tile_end() advances the rows beyond g_tile_N by all the steps of the
+ * block at once, in tiles of -tile-rows rows that stay in the cache. A
+ * tile starts from the rows of the start of the block with T rows of
+ * ghosts on each side, loses a row of ghosts at each side per step and
+ * refreshes the mirrored cells of its rows as createbdry() would. The
+ * mass correction couples the corner with the middle of the outer edge,
+ * so a first tile records the middle at every step. The result is the
+ * same, bit for bit, as T single steps.
+ *
+ * Inside a block the far field lags behind, so the blocks are not used
+ * with the options that look at all of it at every step (golden
+ * trajectories, frames, mass audit, -stop-vapor), nor with noise.
+ */
+double (*g_tile_save)[NC_MAX];
+double (*g_tile_buf[2])[NC_MAX];
+double (*g_tile_tmp)[NC_MAX];
+int g_tile_buf_rows;
+/** d_dif in the middle of the outer edge before each step of the block */
+double g_tile_half[TILE_STEPS_MAX][2];
+
+/** opens a block of at most g_tile_steps steps (and `left`, if > 0) */
+void tile_begin(int left)
+{
+    int T = g_tile_steps, k;
+
+    if ((sigma > 0.0) || (g_golden != 0) || (g_frames_every > 0) || (g_frames_every_r > 0) ||
+        (g_mass_audit_every > 0) || (g_stop_vapor > 0.0))
+        return;
+    if (T > TILE_STEPS_MAX)
+        T = TILE_STEPS_MAX;
+    if ((left > 0) && (T > left))
+        T = left;
+    if ((g_max_steps > 0) && (T > g_max_steps - g_pq))
+        T = g_max_steps - g_pq;
+    if (T < 2)
+        return;
+    // the far field has to hold the middle of the outer edge
+    g_tile_N = g_center_i + g_r_new + 1 + T + 1;
+    if (g_tile_N + 2 > nr / 2)
+        return;
+
+    if (g_tile_save == NULL)
+    {
+        g_tile_buf_rows = ((g_tile_rows > TILE_STEPS_MAX + 1) ? g_tile_rows : TILE_STEPS_MAX + 1) +
+                          2 * TILE_STEPS_MAX + 2;
+        g_tile_save = aligned_alloc(64, 2 * TILE_STEPS_MAX * sizeof(g_tile_save[0]));
+        for (k = 0; k < 2; k++)
+            g_tile_buf[k] = aligned_alloc(64, g_tile_buf_rows * sizeof(g_tile_buf[k][0]));
+        g_tile_tmp = aligned_alloc(64, g_tile_buf_rows * sizeof(g_tile_tmp[0]));
+    }
+    // the halo changes these rows (and the mirrored cells of the last one)
+    memcpy(g_tile_save, d_dif[g_tile_N + 1 - T], 2 * T * sizeof(d_dif[0]));
+    g_tile_T = T;
+    g_tile_done = 0;
+}
+
+/** d_dif of row i at the start of the block */
+const double *tile_src_row(int i)
+{
+    if ((i > g_tile_N - g_tile_T) && (i <= g_tile_N + g_tile_T))
+        return g_tile_save[i - (g_tile_N + 1 - g_tile_T)];
+    return d_dif[i];
+}
+
+/** the mirrored cells of rows a .. b-1 of a tile, in the order of createbdry() */
+void tile_bdry(double (*buf)[NC_MAX], int base, int a, int b)
+{
+    int i;
+
+    for (i = a; i < b; i++)
+    {
+        if (i + 1 < nc)
+            buf[i - base][i + 1] = buf[i + 1 - base][i];
+        if (i + 2 < nc)
+            buf[i - base][i + 2] = buf[i + 2 - base][i];
+    }
+    for (i = (a > 2) ? a : 2; i < b; i++)
+        buf[i - base][0] = buf[i - 1 - base][2];
+    for (i = a; i < b; i++)
+        buf[i - base][nr - i] = buf[i - base][nr - i - 1];
+    if (b == nr - 1)
+    {
+        buf[nr - 1 - base][1] = buf[nr - 2 - base][1];
+        buf[nr - 2 - base][0] = buf[nr - 3 - base][2];
+        buf[nr - 1 - base][0] = buf[nr - 3 - base][2];
+    }
+}
+
+/**
+ * Advances the rows lo .. hi-1 of the far field by s steps in `buf`, row
+ * i is buf[i - (lo - s - 1)]. With `record` it notes the middle of the
+ * outer edge for the mass correction instead.
+ */
+void tile_run(double (*buf)[NC_MAX], int lo, int hi, int s, int record)
+{
+    const double c6 = 1.0 - (double)6 / 7.0;
+    const double *up, *mid, *down;
+    double *out;
+    double mc = 0.0;
+    int base, top, a, b, i, j, jend, t, nrhalf;
+
+    nrhalf = nr / 2;
+    base = lo - s - 1;
+    top = (hi + s + 1 < nr) ? hi + s + 1 : nr;
+    for (i = base; i < top; i++)
+        memcpy(buf[i - base], tile_src_row(i), ((i + 3 < NC_MAX) ? i + 3 : NC_MAX) * sizeof(double));
+
+    for (t = 1; t <= s; t++)
+    {
+        a = lo - s + t;
+        b = (hi + s - t < nr - 1) ? hi + s - t : nr - 1;
+        if (record)
+        {
+            g_tile_half[t - 1][0] = buf[nrhalf - base][nr - nrhalf];
+            g_tile_half[t - 1][1] = buf[nrhalf + 1 - base][nr - nrhalf - 1];
+        }
+        if (b == nr - 1)
+        {
+            if (nr % 2 == 0)
+                mc = (1.0 / 7.0) * (buf[nr - 2 - base][2] + buf[nr - 3 - base][3] - 2.0 * g_tile_half[t - 1][0]);
+            else
+                mc = (1.0 / 7.0) * (buf[nr - 2 - base][2] + buf[nr - 3 - base][3] - g_tile_half[t - 1][0] -
+                                    g_tile_half[t - 1][1]);
+        }
+
+        // the stencil of dynamics_diffusion() with no crystal around
+        for (i = a; i < b; i++)
+        {
+            jend = (i < nr - 1 - i) ? i : nr - 1 - i;
+            up = buf[i - 1 - base];
+            mid = buf[i - base];
+            down = buf[i + 1 - base];
+            out = g_tile_tmp[i - base];
+            for (j = 1; j <= jend; j++)
+                out[j] = c6 * mid[j] + (down[j] + up[j] + mid[j - 1] + mid[j + 1] + up[j + 1] + down[j - 1]) / 7.0;
+        }
+        for (i = a; i < b; i++)
+        {
+            jend = (i < nr - 1 - i) ? i : nr - 1 - i;
+            memcpy(&buf[i - base][1], &g_tile_tmp[i - base][1], jend * sizeof(double));
+        }
+        if (b == nr - 1)
+        {
+            buf[nr - 2 - base][1] -= mc;
+            if ((hi == nr - 1) && !record)
+                g_mass_vapor -= mass_weight(nr - 2, 1) * mc;
+        }
+        tile_bdry(buf, base, a, b);
+    }
+}
+
+/** copies the rows lo .. hi-1 of a tile of s steps to d_dif */
+void tile_write(double (*buf)[NC_MAX], int lo, int hi, int s)
+{
+    int i, jend;
+
+    for (i = lo; i < hi; i++)
+    {
+        jend = (i < nr - 1 - i) ? i : nr - 1 - i;
+        memcpy(&d_dif[i][1], &buf[i - (lo - s - 1)][1], jend * sizeof(double));
+    }
+}
+
+/** closes the block: the far field catches up with the steps done */
+void tile_end()
+{
+    int s = g_tile_done, rows, lo, hi, k = 0, plo = 0, phi = 0;
+    prof_mark m;
+
+    if (s == 0)
+    {
+        g_tile_T = 0;
+        return;
+    }
+    m = prof_begin();
+    tile_run(g_tile_buf[0], nr / 2, nr / 2 + 2, s, 1);
+    // a tile must not read the rows the one before the last wrote
+    rows = (g_tile_rows > s + 1) ? g_tile_rows : s + 1;
+    for (lo = g_tile_N + 1; lo < nr - 1; lo = hi)
+    {
+        hi = (lo + rows < nr - 1) ? lo + rows : nr - 1;
+        if (hi - lo + 2 * s + 2 > g_tile_buf_rows)
+            hi = lo + g_tile_buf_rows - 2 * s - 2;
+        tile_run(g_tile_buf[k], lo, hi, s, 0);
+        if (phi > plo)
+            tile_write(g_tile_buf[1 - k], plo, phi, s);
+        plo = lo;
+        phi = hi;
+        k = 1 - k;
+    }
+    if (phi > plo)
+        tile_write(g_tile_buf[1 - k], plo, phi, s);
+    g_tile_T = 0;
+    createbdry();
+    prof_end(PROF_DIFFUSION, &m);
+}
+
+/** the bookkeeping after each step: frames, counters, stop conditions */
+void sim_after_step()
+{
+    io_frames_check();
+    prof_check();
+    mass_check();
+    obs_check();
+    stop_check();
+    if (!golden_step())
+        stop_set(STOP_GOLDEN);
+}
+
+/**
+ * Advances the simulation by `steps` steps (0: no limit), or until the
+ * radius reached `radius` (0: no target), or g_stop. Returns the number
+ * of steps done. This is the loop of the headless runs and of the
+ * batches of the viewer; nothing else happens between the steps.
+ */
+int sim_run(int steps, int radius)
+{
+    int n;
+
+    for (n = 0; ((steps <= 0) || (n < steps)) && (g_stop == false) && ((radius <= 0) || (g_r_new < radius)); n++)
+    {
+        if ((g_tile_steps > 1) && (g_tile_T == 0))
+            tile_begin((steps > 0) ? steps - n : 0);
+        g_noac = 0;
+        g_pq++;
+        dynamics();
+        if ((g_tile_T > 0) && (++g_tile_done == g_tile_T))
+            tile_end();
+        sim_after_step();
+    }
+    if (g_tile_T > 0)
+        tile_end();
+    return n;
+}
+
+/** runs the simulation without display, then saves state and picture */
+void run_headless()
+{
+    long long t, t0;
+    struct rusage ru;
+
+    gui_init_colors(0);
+    initialize();
+    g_pq = 0;
+    prof_start();
+    trace_start();
+    io_frames_start();
+    obs_start();
+    stop_start();
+    golden_start();
+    t0 = prof_now();
+
+    sim_run(0, 0);
+
+    t0 = prof_now() - t0;
+    io_frames_finish();
+    getrusage(RUSAGE_SELF, &ru);
+    printf(".run_headless: stopped at time %d, radius %d\n", g_pq, g_r_new);
+    // one line for tools/bench-corpus.sh
+    printf(".run_headless: summary steps %d stop %s seconds %.3f steps/s %.1f rss_kb %ld checksum %016llx\n", g_pq,
+           stop_NAMES[g_stop_reason], t0 / 1e9, (t0 > 0) ? 1e9 * g_pq / t0 : 0.0, ru.ru_maxrss, io_state_checksum());
+    t = trace_begin();
+    io_save_state();
+    io_save_snowflake();
+    trace_span("save", t);
+    prof_finish();
+    trace_finish();
+    obs_finish();
+    golden_finish();
+}
+
+/**
+ * Ensemble runs.
+ *
+ * -ensemble FILE runs the parameter sets of FILE, one per line
+ * "beta alpha theta kappa mu gamma" (# starts a comment), in the lanes of
+ * vectors: every cell holds one ens_vec per field and lane l of the
+ * vectors runs a set of its own. rho, h, p, sigma and L come from stdin
+ * and are shared, as is the initial state; each lane draws the random
+ * numbers of the noise from its own copy of the drand48() stream, so a
+ * lane computes exactly what a headless run of its set does, with the
+ * same checksum.
+ *
+ * The phases are those of dynamics_step() on vectors, the branches of
+ * the rules become masks per lane. Freezing, attachment and melting go
+ * up to the largest radius of the running lanes. A lane stops by the
+ * radius, -steps, -stop-radius, -stop-idle or -stop-seconds (-stop-vapor
+ * and -stop-mass are not checked); it is reported and takes the next
+ * set, so short and long runs share the vectors without waiting for
+ * each other. The rows are g_ens_stride (about nc) cells apart instead
+ * of NC_MAX, so small lattices stay in the cache.
+ *
+ * ENS_LANES is what one vector register holds, 2 with SSE2 and 4 with
+ * AVX (-mavx2); -DENS_LANES=8 e.g. for AVX-512. The lanes equal the
+ * scalar runs only if neither is contracted to FMA (-march=native is,
+ * -ffp-contract=off keeps them apart).
+ *
+ * With -ensemble-threads W each of W threads runs an ens_engine, lanes
+ * of its own, and has a deque of sets. The sets are dealt round robin;
+ * an engine takes the next set from the front of its deque and, once
+ * that is empty, steals from the back of the fullest other one. When no
+ * set is left a thread whose lanes are done helps the busy engine with
+ * the fewest helpers: it takes row bands of that engine's diffusion,
+ * the bulk of a step, see ens_bands(). So many short runs keep all the
+ * threads busy and the last long runs are split among them.
+ */
+#ifndef ENS_LANES
+#ifdef __AVX__
+#define ENS_LANES 4
+#else
+#define ENS_LANES 2
+#endif
+#endif
+#define ENS_SETS_MAX 4096
+/** rows of a band of the diffusion */
+#define ENS_BAND_ROWS 8
+/** `work` of an engine without bands to take: pass 0 is never published */
+#define ENS_NO_WORK 0ULL
+
+typedef double ens_vec __attribute__((vector_size(ENS_LANES * sizeof(double))));
+/** what comparing ens_vecs gives, all bits of a lane set or none */
+typedef long ens_mask __attribute__((vector_size(ENS_LANES * sizeof(long))));
+
+/** x where `m` is set, else y (macros: vectors are no arguments without AVX) */
+#define ens_blend(m, x, y) ((ens_vec)(((m) & (ens_mask)(x)) | (~(m) & (ens_mask)(y))))
+/** whether a lane of `m` is set */
+#define ens_any(m) ({ ens_mask m_ = (m); ens_any_of(&m_); })
+
+typedef struct
+{
+    /** the fields of the lanes, cell (i, j) at ENS_CELL(i, j) */
+    ens_vec *dif, *pic, *bfr, *clm, *tmp;
+    int (*ash)[ENS_LANES];
+    /** the parameters of the lanes */
+    ens_vec beta, alpha, theta, kappa, mu, gam;
+    /** the running lanes (all bits set) */
+    ens_mask live;
+    /** per lane the set, its steps and when it started (prof_now()) */
+    int set[ENS_LANES], pq[ENS_LANES];
+    long long t0[ENS_LANES];
+    /** per lane g_r_old, g_r_new, g_par_ash and g_attached of the scalar run */
+    int r_old[ENS_LANES], r_new[ENS_LANES], par_ash[ENS_LANES];
+    long attached[ENS_LANES];
+    /** for -stop-idle: `attached` when last seen, and the step it changed */
+    long attach_seen[ENS_LANES];
+    int attach_pq[ENS_LANES];
+    /** per lane the state of its drand48() stream, see ens_rand() */
+    unsigned long long rng[ENS_LANES];
+
+    /** the deque of sets, [head, tail) */
+    pthread_mutex_t lock;
+    int *jobs;
+    int head, tail;
+    /** the bands of a pass of the diffusion: pass << 32 | next band */
+    atomic_ullong work;
+    /** bands of the pass done, threads helping, whether a lane runs */
+    atomic_int done, helpers, busy;
+    int id;
+    pthread_t thread;
+} ens_engine;
+
+/** beta, alpha, theta, kappa, mu, gamma of each set */
+double g_ens_sets[ENS_SETS_MAX][6];
+int g_ens_nsets;
+/** the sets found in -ensemble-journal */
+char g_ens_resumed[ENS_SETS_MAX];
+int g_ens_nresumed;
+int g_ens_stride;
+#define ENS_CELL(i, j) ((i) * g_ens_stride + (j))
+/** the drand48() stream after initialize(), whose fields every set starts from */
+unsigned long long g_ens_rng;
+ens_engine *g_ens_engines;
+/** sets finished and their steps, for the progress and the summary */
+atomic_int g_ens_finished;
+atomic_llong g_ens_steps;
+/** guards stdout and the journal */
+pthread_mutex_t g_ens_lock = PTHREAD_MUTEX_INITIALIZER;
+FILE *g_ens_journal;
+
+int ens_any_of(const ens_mask *m)
+{
+    int l;
+
+    for (l = 0; l < ENS_LANES; l++)
+        if ((*m)[l])
+            return 1;
+    return 0;
+}
+
+/** drand48() on the state `x` (the 48 bits of erand48()) */
+double ens_rand(unsigned long long *x)
+{
+    *x = (0x5DEECE66DULL * *x + 0xB) & 0xFFFFFFFFFFFFULL;
+    return *x / 281474976710656.0;
+}
+
+/** the last row the phases near the crystal visit, see dynamics_freezing() */
+int ens_iup(ens_engine *e)
+{
+    int l, r = 0;
+
+    for (l = 0; l < ENS_LANES; l++)
+        if (e->live[l] && (e->r_new[l] > r))
+            r = e->r_new[l];
+    return g_center_i + r + 1;
+}
+
+void ens_copy(ens_engine *e, int to, int from)
+{
+    e->dif[to] = e->dif[from];
+    e->pic[to] = e->pic[from];
+    e->bfr[to] = e->bfr[from];
+    e->clm[to] = e->clm[from];
+    memcpy(e->ash[to], e->ash[from], sizeof(e->ash[0]));
+}
+
+/** createbdry() of the lanes */
+void ens_bdry(ens_engine *e)
+{
+    int i, j;
+
+    for (j = 2; j < nc; j++)
+    {
+        ens_copy(e, ENS_CELL(j - 1, j), ENS_CELL(j, j - 1));
+        ens_copy(e, ENS_CELL(j - 2, j), ENS_CELL(j, j - 2));
+    }
+    for (i = 2; i < nr; i++)
+        ens_copy(e, ENS_CELL(i, 0), ENS_CELL(i - 1, 2));
+    ens_copy(e, ENS_CELL(0, 2), ENS_CELL(2, 0));
+    ens_copy(e, ENS_CELL(0, 1), ENS_CELL(2, 0));
+    ens_copy(e, ENS_CELL(1, 0), ENS_CELL(2, 0));
+    for (i = 1; i <= nr - 2; i++)
+        ens_copy(e, ENS_CELL(i, nr - i), ENS_CELL(i, nr - i - 1));
+    ens_copy(e, ENS_CELL(nr - 1, 1), ENS_CELL(nr - 2, 1));
+    ens_copy(e, ENS_CELL(nr - 2, 0), ENS_CELL(nr - 3, 2));
+    ens_copy(e, ENS_CELL(nr - 1, 0), ENS_CELL(nr - 3, 2));
+}
+
+int ens_nbands()
+{
+    return (nr - 2 + ENS_BAND_ROWS) / ENS_BAND_ROWS;
+}
+
+/**
+ * Rows of band `b` of the diffusion, pass 1: the new vapor into `tmp`
+ * (the count == 0 case needs no branch), pass 2: back into `dif`.
+ */
+void ens_band(ens_engine *e, int pass, int b)
+{
+    const int s = g_ens_stride;
+    const ens_vec *a = e->pic;
+    ens_vec *d = e->dif, *nb = e->tmp;
+    ens_vec fd, fu, fl, fr, fur, fdl, count;
+    int i, k, kend, iend;
+
+    iend = (b + 1) * ENS_BAND_ROWS;
+    if (iend > nr - 1)
+        iend = nr - 1;
+    for (i = b * ENS_BAND_ROWS + 1; i <= iend; i++)
+    {
+        kend = ENS_CELL(i, (i < nr - 1 - i) ? i : nr - 1 - i);
+        if (pass == 2)
+        {
+            for (k = ENS_CELL(i, 1); k <= kend; k++)
+                d[k] = nb[k];
+            continue;
+        }
+        for (k = ENS_CELL(i, 1); k <= kend; k++)
+        {
+            // no crystal around in any lane, as in most of the field: the
+            // same sums without the factors 1.0
+            if (!ens_any((a[k] + a[k + s] + a[k - s] + a[k - 1] + a[k + 1] + a[k + 1 - s] + a[k + s - 1]) != 0.0))
+            {
+                nb[k] = (1.0 - 6.0 / 7.0) * d[k] +
+                        (d[k + s] + d[k - s] + d[k - 1] + d[k + 1] + d[k + 1 - s] + d[k + s - 1]) / 7.0;
+                continue;
+            }
+            fd = 1.0 - a[k + s];
+            fu = 1.0 - a[k - s];
+            fl = 1.0 - a[k - 1];
+            fr = 1.0 - a[k + 1];
+            fur = 1.0 - a[k + 1 - s];
+            fdl = 1.0 - a[k + s - 1];
+            count = fd + fu + fl + fr + fur + fdl;
+            nb[k] = ens_blend(a[k] == 0.0,
+                              (1.0 - count / 7.0) * d[k] +
+                                  (d[k + s] * fd + d[k - s] * fu + d[k - 1] * fl + d[k + 1] * fr +
+                                   d[k + 1 - s] * fur + d[k + s - 1] * fdl) /
+                                      7.0,
+                              d[k]);
+        }
+    }
+}
+
+/**
+ * Claims the next of the `n` bands published in `work`. The word is only
+ * advanced by a compare-exchange while a pass (high word) is published and
+ * its next band (low word) is below `n`, so a late thread can neither run
+ * a band of a withdrawn pass nor carry the band count over into the pass.
+ * Returns 0 when there is no band to take.
+ */
+int ens_claim(ens_engine *e, unsigned int n, int *pass, int *b)
+{
+    unsigned long long v = atomic_load(&e->work);
+
+    while (((v >> 32) != 0) && ((v & 0xffffffffULL) < n))
+        if (atomic_compare_exchange_weak(&e->work, &v, v + 1))
+        {
+            *pass = (int)(v >> 32);
+            *b = (int)(v & 0xffffffffULL);
+            return 1;
+        }
+    return 0;
+}
+
+/**
+ * A pass of the diffusion over all bands. With helpers the pass is
+ * published in `work` and every thread claims the next band from it,
+ * until `done` counts all of them.
+ */
+void ens_bands(ens_engine *e, int pass)
+{
+    int b, p, n = ens_nbands();
+
+    if (atomic_load(&e->helpers) == 0)
+    {
+        for (b = 0; b < n; b++)
+            ens_band(e, pass, b);
+        return;
+    }
+    atomic_store(&e->done, 0);
+    atomic_store(&e->work, (unsigned long long)pass << 32);
+    while (ens_claim(e, n, &p, &b))
+    {
+        ens_band(e, p, b);
+        atomic_fetch_add(&e->done, 1);
+    }
+    // the helpers holding the last bands may need this CPU
+    while (atomic_load(&e->done) < n)
+        sched_yield();
+    atomic_store(&e->work, ENS_NO_WORK);
+}
+
+/** takes bands of the diffusion of `e` while a lane of it runs */
+void ens_help(ens_engine *e)
+{
+    int pass, b, n = ens_nbands();
+
+    atomic_fetch_add(&e->helpers, 1);
+    while (atomic_load(&e->busy))
+    {
+        if (!ens_claim(e, n, &pass, &b))
+        {
+            sched_yield();
+            continue;
+        }
+        ens_band(e, pass, b);
+        atomic_fetch_add(&e->done, 1);
+    }
+    atomic_fetch_sub(&e->helpers, 1);
+}
+
+/** the busy engine with the fewest helpers, NULL if none is busy */
+ens_engine *ens_target()
+{
+    ens_engine *t = NULL;
+    int k;
+
+    for (k = 0; k < g_ens_threads; k++)
+        if (atomic_load(&g_ens_engines[k].busy) &&
+            ((t == NULL) || (atomic_load(&g_ens_engines[k].helpers) < atomic_load(&t->helpers))))
+            t = &g_ens_engines[k];
+    return t;
+}
+
+/** dynamics_diffusion() of the lanes */
+void ens_diffusion(ens_engine *e)
+{
+    ens_vec *d = e->dif;
+    ens_vec masscorrection;
+    int nrhalf = nr / 2;
+
+    if (nr % 2 == 0)
+        masscorrection = (1.0 / 7.0) * (d[ENS_CELL(nr - 2, 2)] + d[ENS_CELL(nr - 3, 3)] -
+                                        2.0 * d[ENS_CELL(nrhalf, nr - nrhalf)]);
+    else
+        masscorrection = (1.0 / 7.0) * (d[ENS_CELL(nr - 2, 2)] + d[ENS_CELL(nr - 3, 3)] -
+                                        d[ENS_CELL(nrhalf, nr - nrhalf)] - d[ENS_CELL(nrhalf + 1, nr - nrhalf - 1)]);
+    ens_bands(e, 1);
+    ens_bands(e, 2);
+    d[ENS_CELL(nr - 2, 1)] -= masscorrection;
+    ens_bdry(e);
+}
+
+/** dynamics_freezing() of the lanes, kappa = 0 gives the same as without */
+void ens_freezing(ens_engine *e, int iup)
+{
+    const int s = g_ens_stride;
+    const ens_vec *a = e->pic;
+    ens_vec *d = e->dif, *bf = e->bfr, *c = e->clm;
+    ens_vec offset;
+    ens_mask m;
+    int i, k, kend;
+
+    for (i = 1; (i <= iup) && (i < nr); i++)
+    {
+        kend = ENS_CELL(i, (i < nr - 1 - i) ? i : nr - 1 - i);
+        for (k = ENS_CELL(i, 1); k <= kend; k++)
+        {
+            m = (a[k] == 0.0) & (a[k + s] + a[k - s] + a[k - 1] + a[k + 1] + a[k + 1 - s] + a[k + s - 1] >= 1.0);
+            if (!ens_any(m))
+                continue;
+            offset = (1.0 - e->kappa) * d[k];
+            bf[k] = ens_blend(m, bf[k] + offset, bf[k]);
+            c[k] = ens_blend(m, c[k] + (d[k] - offset), c[k]);
+            d[k] = ens_blend(m, (ens_vec){0}, d[k]);
+        }
+    }
+    ens_bdry(e);
+}
+
+/** dynamics_attachment() of the lanes, `tmp` holds the masks of the new cells */
+void ens_attachment(ens_engine *e, int iup)
+{
+    const int s = g_ens_stride;
+    const ens_vec *a = e->pic, *d = e->dif, *bf = e->bfr;
+    ens_mask *nb = (ens_mask *)e->tmp;
+    ens_vec count, difmass;
+    ens_mask m, attach, theta;
+    int i, j, k, l, r;
+
+    for (i = 1; (i <= iup) && (i < nr); i++)
+        for (j = 1; (j <= i) && (i + j <= nr - 1); j++)
+        {
+            k = ENS_CELL(i, j);
+            count = a[k + s] + a[k - s] + a[k - 1] + a[k + 1] + a[k + 1 - s] + a[k + s - 1];
+            m = (a[k] == 0.0) & (count > 0.0) & e->live;
+            nb[k] = (ens_mask){0};
+            if (!ens_any(m))
+                continue;
+            attach = (count > 3.0) | ((count <= 2.0) & (bf[k] >= e->beta)) | ((count == 3.0) & (bf[k] >= 1.0));
+            theta = m & (count == 3.0) & ~attach & (bf[k] >= e->alpha);
+            if (ens_any(theta))
+            {
+                difmass = d[k] + d[k + s] * (1.0 - a[k + s]) + d[k - s] * (1.0 - a[k - s]) +
+                          d[k - 1] * (1.0 - a[k - 1]) + d[k + 1] * (1.0 - a[k + 1]) +
+                          d[k + 1 - s] * (1.0 - a[k + 1 - s]) + d[k + s - 1] * (1.0 - a[k + s - 1]);
+                attach |= theta & (difmass <= e->theta);
+            }
+            nb[k] = attach & m;
+        }
+    for (i = 1; (i <= iup) && (i < nr); i++)
+        for (j = 1; (j <= i) && (i + j <= nr - 1); j++)
+        {
+            k = ENS_CELL(i, j);
+            if (!ens_any(nb[k]))
+                continue;
+            for (l = 0; l < ENS_LANES; l++)
+                if (nb[k][l])
+                {
+                    e->pic[k][l] = 1.0;
+                    e->clm[k][l] += e->bfr[k][l];
+                    e->attached[l] += (long)mass_weight(i, j);
+                    e->bfr[k][l] = 0.0;
+                    r = norm_inf(i - g_center_i, j - g_center_j);
+                    if (r > e->r_new[l])
+                        e->r_new[l] = r;
+                    e->ash[k][l] = e->par_ash[l];
+                }
+        }
+    for (l = 0; l < ENS_LANES; l++)
+        if (e->live[l] && (e->r_new[l] - e->r_old[l] == 1))
+        {
+            e->par_ash[l]++;
+            e->r_old[l] = e->r_new[l];
+        }
+    ens_bdry(e);
+}
+
+/** dynamics_melting() of the lanes */
+void ens_melting(ens_engine *e, int iup)
+{
+    ens_vec *d = e->dif, *bf = e->bfr, *c = e->clm;
+    ens_vec y, yc, nd;
+    ens_mask m, mc;
+    int i, k, kend;
+
+    for (i = 1; (i <= iup) && (i < nr); i++)
+    {
+        kend = ENS_CELL(i, (i < nr - 1 - i) ? i : nr - 1 - i);
+        for (k = ENS_CELL(i, 1); k <= kend; k++)
+        {
+            m = (e->pic[k] == 0.0);
+            if (!ens_any(m))
+                continue;
+            mc = m & (c[k] > 0.0);
+            y = bf[k] * e->mu;
+            yc = c[k] * e->gam;
+            nd = d[k] + y;
+            bf[k] = ens_blend(m, bf[k] - y, bf[k]);
+            d[k] = ens_blend(mc, nd + yc, ens_blend(m, nd, d[k]));
+            c[k] = ens_blend(mc, c[k] - yc, c[k]);
+        }
+    }
+    ens_bdry(e);
+}
+
+/** dynamics_add_noise() of the lanes, each with its own random numbers */
+void ens_noise(ens_engine *e)
+{
+    ens_vec f = {0};
+    int i, k, kend, l;
+
+    for (i = 1; i < nr; i++)
+    {
+        kend = ENS_CELL(i, (i < nr - 1 - i) ? i : nr - 1 - i);
+        for (k = ENS_CELL(i, 1); k <= kend; k++)
+        {
+            for (l = 0; l < ENS_LANES; l++)
+                f[l] = (ens_rand(&e->rng[l]) < 0.5) ? 1 + sigma : 1 - sigma;
+            e->dif[k] = e->dif[k] * f;
+        }
+    }
+    ens_bdry(e);
+}
+
+/** a step of the lanes, see dynamics_step() */
+void ens_step(ens_engine *e)
+{
+    int l;
+
+    for (l = 0; l < ENS_LANES; l++)
+        e->pq[l]++;
+    ens_diffusion(e);
+    ens_freezing(e, ens_iup(e));
+    ens_attachment(e, ens_iup(e));
+    if (ens_any(((e->mu != 0.0) | (e->gam != 0.0)) & e->live))
+        ens_melting(e, ens_iup(e));
+    if (sigma > 0.0)
+        ens_noise(e);
+}
+
+/** reads -ensemble, returns the number of sets */
+int ens_read()
+{
+    char line[256];
+    double *p;
+    int n = 0;
+    FILE *f;
+
+    f = fopen(g_ens_path, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, ".run_ensemble: cannot open '%s'\n", g_ens_path);
+        return 0;
+    }
+    g_ens_nsets = 0;
+    while ((fgets(line, sizeof(line), f) != NULL) && (g_ens_nsets < ENS_SETS_MAX))
+    {
+        n++;
+        p = g_ens_sets[g_ens_nsets];
+        if (sscanf(line, "%lf %lf %lf %lf %lf %lf", &p[0], &p[1], &p[2], &p[3], &p[4], &p[5]) == 6)
+            g_ens_nsets++;
+        else if (line[strspn(line, " \t\r\n")] != '\0' && line[strspn(line, " \t")] != '#')
+            fprintf(stderr, ".run_ensemble: %s:%d ignored\n", g_ens_path, n);
+    }
+    fclose(f);
+    return g_ens_nsets;
+}
+
+/** the start of the line of set `n` (0 ...), up to the steps */
+void ens_line_head(char *buf, size_t size, int n)
+{
+    double *p = g_ens_sets[n];
+
+    snprintf(buf, size, ".run_ensemble: set %d beta %g alpha %g theta %g kappa %g mu %g gamma %g steps ", n + 1,
+             p[0], p[1], p[2], p[3], p[4], p[5]);
+}
+
+/**
+ * Marks the sets whose line is in -ensemble-journal (with the same
+ * parameters) as done, then opens it to append the others.
+ */
+void ens_resume()
+{
+    char line[512], head[256];
+    int n;
+    FILE *f;
+
+    g_ens_nresumed = 0;
+    memset(g_ens_resumed, 0, sizeof(g_ens_resumed));
+    if (g_ens_journal_path[0] == '\0')
+        return;
+    f = fopen(g_ens_journal_path, "r");
+    if (f != NULL)
+    {
+        while (fgets(line, sizeof(line), f) != NULL)
+            if ((sscanf(line, ".run_ensemble: set %d", &n) == 1) && (n >= 1) && (n <= g_ens_nsets) &&
+                !g_ens_resumed[n - 1])
+            {
+                ens_line_head(head, sizeof(head), n - 1);
+                if (strncmp(line, head, strlen(head)) == 0)
+                {
+                    g_ens_resumed[n - 1] = 1;
+                    g_ens_nresumed++;
+                }
+            }
+        fclose(f);
+    }
+    g_ens_journal = fopen(g_ens_journal_path, "a");
+    if (g_ens_journal == NULL)
+        fprintf(stderr, ".run_ensemble: cannot open '%s'\n", g_ens_journal_path);
+}
+
+/** starts set `n` in lane `l` from the state of initialize() */
+void ens_load(ens_engine *e, int l, int n)
+{
+    double *p = g_ens_sets[n];
+    int i, j, k;
+
+    for (i = 0; i < nr; i++)
+        for (j = 0; j < nc; j++)
+        {
+            k = ENS_CELL(i, j);
+            e->dif[k][l] = d_dif[i][j];
+            e->pic[k][l] = a_pic[i][j];
+            e->bfr[k][l] = b__fr[i][j];
+            e->clm[k][l] = c__lm[i][j];
+            e->ash[k][l] = ash[i][j];
+        }
+    e->beta[l] = p[0];
+    e->alpha[l] = p[1];
+    e->theta[l] = p[2];
+    e->kappa[l] = p[3];
+    e->mu[l] = p[4];
+    e->gam[l] = p[5];
+    e->live[l] = -1;
+    e->set[l] = n;
+    e->pq[l] = 0;
+    e->t0[l] = prof_now();
+    e->r_old[l] = g_r_old;
+    e->r_new[l] = g_r_new;
+    e->par_ash[l] = g_par_ash;
+    e->attached[l] = 0;
+    e->attach_seen[l] = 0;
+    e->attach_pq[l] = 0;
+    e->rng[l] = g_ens_rng;
+}
+
+/**
+ * The next set for `e`: the front of its own deque, else the back of
+ * the fullest other one. -1 when none is left.
+ */
+int ens_take(ens_engine *e)
+{
+    ens_engine *v;
+    int n = -1, k, most, left;
+
+    pthread_mutex_lock(&e->lock);
+    if (e->head < e->tail)
+        n = e->jobs[e->head++];
+    pthread_mutex_unlock(&e->lock);
+    while (n < 0)
+    {
+        v = NULL;
+        most = 0;
+        for (k = 0; k < g_ens_threads; k++)
+        {
+            pthread_mutex_lock(&g_ens_engines[k].lock);
+            left = g_ens_engines[k].tail - g_ens_engines[k].head;
+            pthread_mutex_unlock(&g_ens_engines[k].lock);
+            if (left > most)
+            {
+                most = left;
+                v = &g_ens_engines[k];
+            }
+        }
+        if (v == NULL)
+            return -1;
+        pthread_mutex_lock(&v->lock);
+        if (v->head < v->tail)
+            n = v->jobs[--v->tail];
+        pthread_mutex_unlock(&v->lock);
+    }
+    return n;
+}
+
+/** the stop reason of lane `l` after its step, see stop_check() */
+int ens_stop(ens_engine *e, int l)
+{
+    int pq = e->pq[l];
+
+    if (e->attached[l] != e->attach_seen[l])
+    {
+        e->attach_seen[l] = e->attached[l];
+        e->attach_pq[l] = pq;
+    }
+    if (e->r_new[l] > 2 * nr / 3)
+        return STOP_RADIUS;
+    if ((g_max_steps > 0) && (pq >= g_max_steps))
+        return STOP_STEPS;
+    if ((g_stop_radius > 0) && (e->r_new[l] >= g_stop_radius))
+        return STOP_TARGET;
+    if ((g_stop_seconds > 0.0) && (prof_now() - e->t0[l] >= g_stop_seconds * 1e9))
+        return STOP_SECONDS;
+    if ((pq >= g_stop_window) && (g_stop_idle > 0) && (pq - e->attach_pq[l] >= g_stop_idle))
+        return STOP_IDLE;
+    return STOP_NONE;
+}
+
+/** io_state_checksum() of lane `l` */
+unsigned long long ens_checksum(ens_engine *e, int l)
+{
+    unsigned long long h = IO_FNV_BASIS;
+    double rowd[NC_MAX];
+    int rowi[NC_MAX];
+    int i, j;
+    int r[3];
+
+    for (i = 0; i < nr; i++)
+    {
+        for (j = 0; j < nc; j++)
+            rowd[j] = e->dif[ENS_CELL(i, j)][l];
+        h = io_fnv(h, rowd, nc * sizeof(rowd[0]));
+        for (j = 0; j < nc; j++)
+            rowi[j] = (int)e->pic[ENS_CELL(i, j)][l];
+        h = io_fnv(h, rowi, nc * sizeof(rowi[0]));
+        for (j = 0; j < nc; j++)
+            rowd[j] = e->bfr[ENS_CELL(i, j)][l];
+        h = io_fnv(h, rowd, nc * sizeof(rowd[0]));
+        for (j = 0; j < nc; j++)
+            rowd[j] = e->clm[ENS_CELL(i, j)][l];
+        h = io_fnv(h, rowd, nc * sizeof(rowd[0]));
+        for (j = 0; j < nc; j++)
+            rowi[j] = e->ash[ENS_CELL(i, j)][l];
+        h = io_fnv(h, rowi, nc * sizeof(rowi[0]));
+    }
+    r[0] = e->r_old[l];
+    r[1] = e->r_new[l];
+    r[2] = e->pq[l];
+    return io_fnv(h, r, sizeof(r));
+}
+
+/** the crystal mass of lane `l`, as mass_audit() counts it */
+double ens_crystal(ens_engine *e, int l)
+{
+    double s = 0.0, c = 0.0;
+    int i, j;
+
+    for (i = 2; i <= nr - 2; i++)
+        for (j = 1; (j <= i) && (i + j <= nr - 1); j++)
+            mass_add(&s, &c, mass_weight(i, j) * e->clm[ENS_CELL(i, j)][l]);
+    return s + c + e->clm[ENS_CELL(1, 1)][l];
+}
+
+/** reports the set of lane `l`, on stdout and in the journal */
+void ens_finish(ens_engine *e, int l, int reason)
+{
+    char line[512];
+    size_t n;
+
+    ens_line_head(line, sizeof(line), e->set[l]);
+    n = strlen(line);
+    snprintf(line + n, sizeof(line) - n, "%d stop %s radius %d crystal %.6f seconds %.3f checksum %016llx\n",
+             e->pq[l], stop_NAMES[reason], e->r_new[l], ens_crystal(e, l), (prof_now() - e->t0[l]) / 1e9,
+             ens_checksum(e, l));
+    pthread_mutex_lock(&g_ens_lock);
+    fputs(line, stdout);
+    if (g_ens_journal != NULL)
+    {
+        fputs(line, g_ens_journal);
+        fflush(g_ens_journal);
+    }
+    pthread_mutex_unlock(&g_ens_lock);
+    atomic_fetch_add(&g_ens_steps, e->pq[l]);
+    atomic_fetch_add(&g_ens_finished, 1);
+}
+
+/**
+ * A thread of the ensemble: runs the sets of its deque and what it can
+ * steal in the lanes of its engine, then helps the others.
+ */
+void *ens_worker(void *arg)
+{
+    ens_engine *e = arg, *t;
+    size_t cells = (nr + 1) * g_ens_stride;
+    int l, n, reason;
+
+    trace_thread("ensemble");
+    if (g_numa_npin > 0)
+        numa_pin(g_numa_pin[e->id % g_numa_npin]);
+    // allocated and first touched here, on the node of the thread
+    e->dif = aligned_alloc(64, cells * sizeof(e->dif[0]));
+    e->pic = aligned_alloc(64, cells * sizeof(e->pic[0]));
+    e->bfr = aligned_alloc(64, cells * sizeof(e->bfr[0]));
+    e->clm = aligned_alloc(64, cells * sizeof(e->clm[0]));
+    e->tmp = aligned_alloc(64, cells * sizeof(e->tmp[0]));
+    e->ash = aligned_alloc(64, cells * sizeof(e->ash[0]));
+    memset(e->dif, 0, cells * sizeof(e->dif[0]));
+    memset(e->pic, 0, cells * sizeof(e->pic[0]));
+    memset(e->bfr, 0, cells * sizeof(e->bfr[0]));
+    memset(e->clm, 0, cells * sizeof(e->clm[0]));
+    memset(e->tmp, 0, cells * sizeof(e->tmp[0]));
+    memset(e->ash, 0, cells * sizeof(e->ash[0]));
+
+    for (l = 0; l < ENS_LANES; l++)
+        if ((n = ens_take(e)) >= 0)
+            ens_load(e, l, n);
+    atomic_store(&e->busy, ens_any(e->live));
+    while (ens_any(e->live))
+    {
+        ens_step(e);
+        for (l = 0; l < ENS_LANES; l++)
+            if (e->live[l] && ((reason = ens_stop(e, l)) != STOP_NONE))
+            {
+                ens_finish(e, l, reason);
+                e->live[l] = 0;
+                if ((n = ens_take(e)) >= 0)
+                    ens_load(e, l, n);
+            }
+    }
+    atomic_store(&e->busy, 0);
+    while ((t = ens_target()) != NULL)
+        ens_help(t);
+    return NULL;
+}
+
+/** runs the sets of -ensemble, see ens_worker() */
+void run_ensemble()
+{
+    unsigned short seed[3] = {0, 0, 0}, *x;
+    ens_engine *e;
+    long long t0, t, last;
+    int k, n, todo = 0;
+    size_t size;
+
+    if (ens_read() == 0)
+        return;
+    ens_resume();
+    if (g_ens_threads < 1)
+        g_ens_threads = 1;
+    g_ens_stride = (nc + 8) & ~7;
+
+    // every set starts from this state and stream of random numbers
+    initialize();
+    x = seed48(seed);
+    g_ens_rng = x[0] | ((unsigned long long)x[1] << 16) | ((unsigned long long)x[2] << 32);
+
+    // the lanes (ens_vec, ens_mask) in the engines need the vector alignment
+    size = (g_ens_threads * sizeof(ens_engine) + 63) & ~(size_t)63;
+    g_ens_engines = aligned_alloc(64, size);
+    memset(g_ens_engines, 0, size);
+    for (k = 0; k < g_ens_threads; k++)
+    {
+        e = &g_ens_engines[k];
+        e->id = k;
+        e->jobs = malloc(g_ens_nsets * sizeof(e->jobs[0]));
+        pthread_mutex_init(&e->lock, NULL);
+        atomic_store(&e->work, ENS_NO_WORK);
+    }
+    for (n = 0; n < g_ens_nsets; n++)
+        if (!g_ens_resumed[n])
+        {
+            e = &g_ens_engines[todo++ % g_ens_threads];
+            e->jobs[e->tail++] = n;
+        }
+    printf(".run_ensemble: %d sets (%d in the journal), %d lanes, %d threads\n", g_ens_nsets, g_ens_nresumed,
+           ENS_LANES, g_ens_threads);
+
+    t0 = last = prof_now();
+    for (k = 0; k < g_ens_threads; k++)
+        pthread_create(&g_ens_engines[k].thread, NULL, ens_worker, &g_ens_engines[k]);
+    while (atomic_load(&g_ens_finished) < todo)
+    {
+        sleep_ms(100);
+        t = prof_now();
+        if ((g_ens_progress > 0.0) && (t - last >= g_ens_progress * 1e9))
+        {
+            last = t;
+            pthread_mutex_lock(&g_ens_lock);
+            printf(".run_ensemble: progress %d/%d sets, seconds %.1f steps/s %.1f\n", atomic_load(&g_ens_finished),
+                   todo, (t - t0) / 1e9, 1e9 * atomic_load(&g_ens_steps) / (t - t0));
+            fflush(stdout);
+            pthread_mutex_unlock(&g_ens_lock);
+        }
+    }
+    for (k = 0; k < g_ens_threads; k++)
+        pthread_join(g_ens_engines[k].thread, NULL);
+    t0 = prof_now() - t0;
+    printf(".run_ensemble: summary sets %d lanes %d threads %d seconds %.3f steps/s %.1f\n", todo, ENS_LANES,
+           g_ens_threads, t0 / 1e9, (t0 > 0) ? 1e9 * atomic_load(&g_ens_steps) / t0 : 0.0);
+
+    for (k = 0; k < g_ens_threads; k++)
+    {
+        e = &g_ens_engines[k];
+        free(e->dif);
+        free(e->pic);
+        free(e->bfr);
+        free(e->clm);
+        free(e->tmp);
+        free(e->ash);
+        free(e->jobs);
+    }
+    free(g_ens_engines);
+    if (g_ens_journal != NULL)
+        fclose(g_ens_journal);
+}
+
+/**
+ * Kernel benchmark.
+ *
+ * For each L of -bench-sizes every kernel is timed in isolation on two
+ * states: "synthetic", a hexagon of a third of the grid with noisy vapor
+ * and boundary mass around it, and "grown", the initial state of the
+ * parameters after -bench-steps steps of the dynamics. The state is
+ * restored before each repetition (outside the timing), so every
+ * repetition sees the same input. After two warm-up runs a kernel is
+ * repeated for at least -bench-ms (and 5 times).
+ *
+ * The dynamics_*() kernels include their createbdry(), which dominates
+ * the ones sweeping only the rows up to a small crystal.
+ * ns/cell is per cell the kernel sweeps. GB/s is the nominal traffic:
+ * the bytes of the fields the kernel reads and writes per cell (each
+ * once), or the file size for save/load.
+ */
+typedef struct
+{
+    const char *name;
+    void (*run)();
+    /** fields read + written per cell, 0: the file size */
+    int bytes;
+    /** sweeps the rows up to the crystal only */
+    int near;
+    /** covers all nr x nc cells, not the wedge */
+    int full;
+} bench_kernel;
+
+typedef struct
+{
+    double (*d_dif)[NC_MAX];
+    int (*a_pic)[NC_MAX];
+    double (*b__fr)[NC_MAX];
+    double (*c__lm)[NC_MAX];
+    int (*ash)[NC_MAX];
+    int r_old, r_new, par_ash, par_update, stop, pq;
+} bench_state;
+
+void bench_render()
+{
+    render_wedge(&g_live, 0, g_cell_color);
+}
+
+void bench_save()
+{
+    io_save_state();
+}
+
+void bench_load()
+{
+    io_read_state();
+}
+
+const bench_kernel bench_KERNELS[] = {
+    {"diffusion", dynamics_diffusion, 4 + 8 + 8 + 3 * 8, 0, 0},
+    {"freezing", dynamics_freezing, 4 + 3 * 16, 1, 0},
+    {"attachment", dynamics_attachment, 2 * 4 + 2 * 4 + 8 + 8, 1, 0},
+    {"melting", dynamics_melting, 4 + 3 * 16, 1, 0},
+    {"noise", dynamics_add_noise, 16, 0, 0},
+    {"boundary", createbdry, 0, 0, 0},
+    {"render", bench_render, 4 + 8 + 8 + 4 + 8, 0, 1},
+    {"save", bench_save, 0, 0, 1},
+    {"load", bench_load, 0, 0, 1},
+};
+
+void bench_alloc(bench_state *b)
+{
+    b->d_dif = malloc(nr * sizeof(*b->d_dif));
+    b->a_pic = malloc(nr * sizeof(*b->a_pic));
+    b->b__fr = malloc(nr * sizeof(*b->b__fr));
+    b->c__lm = malloc(nr * sizeof(*b->c__lm));
+    b->ash = malloc(nr * sizeof(*b->ash));
+}
 
-    dum = getchar();
-    while (dum != ':')
-        dum = getchar();
+void bench_free(bench_state *b)
+{
+    free(b->d_dif);
+    free(b->a_pic);
+    free(b->b__fr);
+    free(b->c__lm);
+    free(b->ash);
 }
 
-void io_read_state()
+void bench_keep(bench_state *b)
+{
+    memcpy(b->d_dif, d_dif, nr * sizeof(*b->d_dif));
+    memcpy(b->a_pic, a_pic, nr * sizeof(*b->a_pic));
+    memcpy(b->b__fr, b__fr, nr * sizeof(*b->b__fr));
+    memcpy(b->c__lm, c__lm, nr * sizeof(*b->c__lm));
+    memcpy(b->ash, ash, nr * sizeof(*b->ash));
+    b->r_old = g_r_old;
+    b->r_new = g_r_new;
+    b->par_ash = g_par_ash;
+    b->par_update = g_par_update;
+    b->stop = g_stop;
+    b->pq = g_pq;
+}
 
+void bench_restore(bench_state *b)
 {
-    int i, j, k;
-    double x;
+    memcpy(d_dif, b->d_dif, nr * sizeof(*b->d_dif));
+    memcpy(a_pic, b->a_pic, nr * sizeof(*b->a_pic));
+    memcpy(b__fr, b->b__fr, nr * sizeof(*b->b__fr));
+    memcpy(c__lm, b->c__lm, nr * sizeof(*b->c__lm));
+    memcpy(ash, b->ash, nr * sizeof(*b->ash));
+    order_reset();
+    g_r_old = b->r_old;
+    g_r_new = b->r_new;
+    g_par_ash = b->par_ash;
+    g_par_update = b->par_update;
+    g_stop = b->stop;
+    g_pq = b->pq;
+}
 
-    printf(".io_read_state: reading simulation state from file '%s'\n", g_in_file_path);
-    g_state_file = fopen(g_in_file_path, "r");
+/** the "synthetic" state: a large crystal with vapor and boundary mass */
+void bench_synthetic()
+{
+    int i, j, r;
 
+    r = nr / 3;
     for (i = 0; i < nr; i++)
     {
         for (j = 0; j < nc; j++)
         {
-            fscanf(g_state_file, "%lf", &x);
-            d_dif[i][j] = x;
-            fscanf(g_state_file, "%d", &k);
-            a_pic[i][j] = k;
-            fscanf(g_state_file, "%lf", &x);
-            b__fr[i][j] = x;
-            fscanf(g_state_file, "%d", &k);
-            ash[i][j] = k;
-            fscanf(g_state_file, "%lf", &x);
-            c__lm[i][j] = x;
+            if ((norm_inf(i - g_center_i, j - g_center_j) <= r) && (semi_norm(i - g_center_i, j - g_center_j) <= r))
+            {
+                d_dif[i][j] = 0.0;
+                a_pic[i][j] = 1;
+                b__fr[i][j] = 0.0;
+                c__lm[i][j] = 1.0;
+                ash[i][j] = norm_inf(i - g_center_i, j - g_center_j);
+            }
+            else
+            {
+                d_dif[i][j] = init_gas_rho * (0.5 + uniform_01rand());
+                a_pic[i][j] = 0;
+                b__fr[i][j] = (norm_inf(i - g_center_i, j - g_center_j) <= r + 1) ? beta * uniform_01rand() : 0.0;
+                c__lm[i][j] = 0.0;
+                ash[i][j] = 0;
+            }
         }
     }
-    fscanf(g_state_file, "%d", &k);
-    g_r_old = k;
-    fscanf(g_state_file, "%d", &k);
-    g_r_new = k;
-    fscanf(g_state_file, "%d", &k);
-    g_pq = k;
+    g_r_old = g_r_new = r;
+    g_par_ash = r;
+    createbdry();
+    buildbig();
+}
 
-    fclose(g_state_file);
-    printf(".io_read_state: File read finished.\n");
+/** stdout off (the messages of save/load) while timing */
+int bench_mute(int fd)
+{
+    int null;
+
+    fflush(stdout);
+    if (fd >= 0)
+    {
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+        return -1;
+    }
+    fd = dup(STDOUT_FILENO);
+    null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+    return fd;
 }
 
-void io_save_state()
+/** times one kernel on the kept state, appends its JSON record */
+void bench_kernel_run(FILE *out, const bench_kernel *k, bench_state *b, const char *state, int first)
+{
+    long long t, ns, cells, file_bytes = 0;
+    double sum = 0.0, sum2 = 0.0, mean, sd, min = 0.0, max = 0.0, x;
+    long long end;
+    int n, reps = 0, fd;
+    FILE *f;
+
+    fd = bench_mute(-1);
+    end = prof_now() + (long long)g_bench_ms * 1000000;
+    for (n = 0; (n < 2) || (reps < 5) || (prof_now() < end); n++)
+    {
+        bench_restore(b);
+        t = prof_now();
+        k->run();
+        ns = prof_now() - t;
+        if (n < 2)
+            continue;
+        x = (double)ns;
+        sum += x;
+        sum2 += x * x;
+        if ((reps == 0) || (x < min))
+            min = x;
+        if (x > max)
+            max = x;
+        reps++;
+    }
+    bench_mute(fd);
+    bench_restore(b);
+
+    if (k->bytes == 0)
+    {
+        f = fopen(g_out_file_path, "r");
+        if (f != NULL)
+        {
+            fseek(f, 0, SEEK_END);
+            file_bytes = ftell(f);
+            fclose(f);
+        }
+    }
+    if (k->full)
+        cells = (long long)nr * nc;
+    else
+        cells = sweep_cells(k->near ? g_center_i + g_r_new + 1 : nr - 1);
+    mean = sum / reps;
+    sd = sqrt(fmax(0.0, sum2 / reps - mean * mean));
+
+    fprintf(out, "%s\n    {\"L\":%d,\"state\":\"%s\",\"kernel\":\"%s\",\"reps\":%d,\"cells\":%lld,", first ? "" : ",", nr,
+            state, k->name, reps, cells);
+    fprintf(out, "\"mean_ns\":%.0f,\"stddev_ns\":%.0f,\"min_ns\":%.0f,\"max_ns\":%.0f,\"ns_per_cell\":%.3f,", mean, sd,
+            min, max, mean / cells);
+    if ((k->bytes > 0) || (file_bytes > 0))
+        fprintf(out, "\"gb_per_s\":%.3f}", (k->bytes > 0 ? (double)k->bytes * cells : (double)file_bytes) / mean);
+    else
+        fprintf(out, "\"gb_per_s\":null}");
+    printf(".run_bench: L=%-5d %-9s %-10s %6d reps %12.0f ns %8.3f ns/cell +- %.1f%%\n", nr, state, k->name, reps,
+           mean, mean / cells, 100.0 * sd / mean);
+}
 
+/** runs the kernel benchmark, see bench_kernel */
+void run_bench()
 {
-    int i, j;
+    FILE *out;
+    bench_state b;
+    char sizes[MAX_IO_PATH_LEN], *tok, *saveptr;
+    char in_path[MAX_IO_PATH_LEN], out_path[MAX_IO_PATH_LEN];
+    int L, s, k, first = 1;
+
+    out = fopen(g_bench_path, "w");
+    if (out == NULL)
+    {
+        fprintf(stderr, ".run_bench: cannot open '%s'\n", g_bench_path);
+        return;
+    }
 
-    printf(".io_save_state: saving simulation state to file '%s'\n", g_out_file_path);
-    g_state_file = fopen(g_out_file_path, "w");
+    // save/load go through a scratch file, not the output of the parameters
+    memcpy(in_path, g_in_file_path, MAX_IO_PATH_LEN);
+    memcpy(out_path, g_out_file_path, MAX_IO_PATH_LEN);
+    snprintf(g_out_file_path, MAX_IO_PATH_LEN, "%.*s.bench", MAX_IO_PATH_LEN - 7, g_bench_path);
+    memcpy(g_in_file_path, g_out_file_path, MAX_IO_PATH_LEN);
 
-    for (i = 0; i < nr; i++)
+    gui_init_colors(0);
+    fprintf(out, "{\"rho\":%g,\"beta\":%g,\"alpha\":%g,\"theta\":%g,\"kappa\":%g,\"mu\":%g,\"gamma\":%g,\"sigma\":%g,",
+            init_gas_rho, beta, alpha, theta, kappa, mu, gam, sigma);
+    fprintf(out, "\"bench_ms\":%d,\"grown_steps\":%d,\"time\":%ld,\n  \"results\":[", g_bench_ms, g_bench_steps,
+            (long)time(NULL));
+
+    snprintf(sizes, sizeof(sizes), "%s", g_bench_sizes);
+    for (tok = strtok_r(sizes, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr))
     {
-        for (j = 0; j < nc; j++)
+        L = atoi(tok);
+        if ((L < 8) || (L > NR_MAX - 1))
         {
-            fprintf(g_state_file, "%.10lf %d %.10lf %d %.10lf ", d_dif[i][j], a_pic[i][j], b__fr[i][j], ash[i][j], c__lm[i][j]);
+            printf(".run_bench: L=%d skipped, the arrays hold 8 ... %d\n", L, NR_MAX - 1);
+            fprintf(out, "%s\n    {\"L\":%d,\"skipped\":\"outside 8 ... NR_MAX - 1 = %d\"}", first ? "" : ",", L,
+                    NR_MAX - 1);
+            first = 0;
+            continue;
+        }
+        nr = nc = L;
+        bench_alloc(&b);
+        for (s = 0; s < 2; s++)
+        {
+            initialize();
+            if (s == 0)
+                bench_synthetic();
+            else
+                for (g_pq = 1; (g_pq <= g_bench_steps) && (g_stop == false); g_pq++)
+                    dynamics();
+            bench_keep(&b);
+            for (k = 0; k < (int)(sizeof(bench_KERNELS) / sizeof(bench_KERNELS[0])); k++)
+            {
+                bench_kernel_run(out, &bench_KERNELS[k], &b, (s == 0) ? "synthetic" : "grown", first);
+                first = 0;
+            }
         }
+        bench_free(&b);
     }
-    fprintf(g_state_file, "%d %d ", g_r_old, g_r_new);
-    fprintf(g_state_file, "%d ", g_pq);
-    fclose(g_state_file);
-    printf(".io_save_state: File written successfully.\n");
-}
+    fprintf(out, "\n  ]}\n");
+    fclose(out);
 
-void io_save_snowflake()
+    remove(g_out_file_path);
+    memcpy(g_in_file_path, in_path, MAX_IO_PATH_LEN);
+    memcpy(g_out_file_path, out_path, MAX_IO_PATH_LEN);
+    printf(".run_bench: results written to '%s'\n", g_bench_path);
+}
 
+/**
+ * Publishes the live fields to the viewer. Unless `force`d, nothing is
+ * copied while the viewer has not taken the last snapshot yet, so the
+ * simulation runs at its own pace and frames are dropped when the
+ * display falls behind.
+ */
+void sim_publish(int force)
 {
+    if (!force && (atomic_load(&g_snap_ready) & SNAP_FRESH))
+        return;
 
-    int i, j, i1, j1, k, pqn, kf;
-
-    char pqc[10];
+    snapshot_take(&g_snap[g_snap_back]);
+    g_snap_back = atomic_exchange(&g_snap_ready, g_snap_back | SNAP_FRESH) & ~SNAP_FRESH;
+}
 
-    /*  char g_grahics_viewer_name[30]="xv ";*/
+/** takes the newest published snapshot, returns 0 if there is none */
+int gui_take_snapshot()
+{
+    if (!(atomic_load(&g_snap_ready) & SNAP_FRESH))
+        return 0;
 
-    double totalmass;
+    g_snap_front = atomic_exchange(&g_snap_ready, g_snap_front) & ~SNAP_FRESH;
+    return 1;
+}
 
-    double y;
+/** sends a button of the viewer (and its argument) to the simulation thread */
+void sim_send(int cmd, int arg)
+{
+    unsigned int tail;
+
+    tail = atomic_load_explicit(&g_sim_cmd_tail, memory_order_relaxed);
+    while (tail - atomic_load_explicit(&g_sim_cmd_head, memory_order_acquire) >= SIM_CMD_RING)
+        sleep_ms(1);
+    g_sim_cmds[tail % SIM_CMD_RING] = cmd;
+    g_sim_args[tail % SIM_CMD_RING] = arg;
+    atomic_store_explicit(&g_sim_cmd_tail, tail + 1, memory_order_release);
+}
 
-    /*char g_grahics_viewer_name[30]="gimp ";*/
+/** next button for the simulation thread, 0 if there is none */
+int sim_receive(int *arg)
+{
+    unsigned int head;
+    int cmd;
 
-    FILE *dum;
+    head = atomic_load_explicit(&g_sim_cmd_head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&g_sim_cmd_tail, memory_order_acquire))
+        return 0;
+    cmd = g_sim_cmds[head % SIM_CMD_RING];
+    *arg = g_sim_args[head % SIM_CMD_RING];
+    atomic_store_explicit(&g_sim_cmd_head, head + 1, memory_order_release);
+    return cmd;
+}
 
-    /** 
-     * takes (i,j) from 0 ... 2(nc-2)+1,
-     * outputs (i1,j1) in the 4th quadrant
-     **/
-    void transform()
+/**
+ * The simulation of the viewer. It owns the fields; the viewer only
+ * sees the snapshots of sim_publish() and talks to it with sim_send().
+ *
+ * [play] and the batch buttons run sim_run() in batches of about
+ * SIM_BATCH_MS, so the steps go without polling in between and the
+ * viewer still gets a snapshot (and the buttons an answer) per batch.
+ */
+void *sim_thread(void *arg)
+{
+    int cmd, n, batch = 1;
+    int cmd_arg;
+    /** steps left to run (-1: [play]), radius to reach (0: none) */
+    int left = 0, radius = 0;
+    long long t;
+
+    trace_thread("simulation");
+    numa_pin_dynamics();
+    for (;;)
     {
-        int x1, y1, z1, n1;
-
-        n1 = nc - 2;
-        x1 = j - n1;
-        y1 = n1 - i;
-        while ((x1 < 0) || (y1 > 0))
+        cmd = sim_receive(&cmd_arg);
+        if (cmd == 0)
         {
-            if ((y1 > 0) && (y1 <= x1))
-            {
-                x1 = x1 - y1;
-                y1 = -y1;
-            }
-            else if ((x1 > 0) && (x1 <= y1))
+            if ((left != 0) && (g_stop == false) && ((radius <= 0) || (g_r_new < radius)))
             {
-                z1 = x1;
-                x1 = y1;
-                y1 = z1;
+                t = prof_now();
+                n = sim_run((left > 0 && left < batch) ? left : batch, radius);
+                if (left > 0)
+                    left -= n;
+                t = prof_now() - t;
+                if ((t < SIM_BATCH_MS * 1000000LL / 2) && (batch < (1 << 20)))
+                    batch *= 2;
+                else if ((t > SIM_BATCH_MS * 1000000LL * 2) && (batch > 1))
+                    batch /= 2;
+                sim_publish(0);
             }
             else
             {
-                x1 = -x1;
-                y1 = -y1;
+                if (left != 0)
+                    sim_publish(1);
+                left = 0;
+                radius = 0;
+                sleep_ms(1);
             }
+            continue;
         }
-        i1 = -y1 + 1;
-        j1 = x1 + 1;
-    }
-
-    printf(".io_save_snowflake: saving snowflake image to file '%s'\n", g_graphics_file_path);
-    g_state_file = fopen(g_graphics_file_path, "w");
-    fprintf(g_state_file, "P3\n");
-
-    fprintf(g_state_file, "#rho:%lf\n", init_gas_rho);
-    fprintf(g_state_file, "#h:%d\n", init_crystal_seed_radius);
-    fprintf(g_state_file, "#p:%lf\n", init_crystal_seed_probability);
-    fprintf(g_state_file, "#beta:%lf\n", beta);
-    fprintf(g_state_file, "#alpha:%lf\n", alpha);
-    fprintf(g_state_file, "#theta:%lf\n", theta);
-    fprintf(g_state_file, "#kappa:%lf\n", kappa);
-    fprintf(g_state_file, "#mu:%lf\n", mu);
-    fprintf(g_state_file, "#gam:%lf\n", gam);
-    fprintf(g_state_file, "#sigma:%lf\n", sigma);
-
-    fprintf(g_state_file, "#L:%d\n", nr);
-    fprintf(g_state_file, "#Z:%d\n", sp);
 
-    fprintf(g_state_file, "#: no : no : no \n");
+        // as before, any button stops [play] (and a batch)
+        if (left != 0)
+            sim_publish(1);
+        left = 0;
+        radius = 0;
 
-    fprintf(g_state_file, "#: %s\n", g_grahics_viewer_name);
-    fprintf(g_state_file, "#: %s\n", g_comments);
+        switch (cmd)
+        {
+        case SIM_PLAY:
+            left = -1;
+            break;
 
-    fprintf(g_state_file, "%d %d\n", 2 * (nc - 2) + 1, 2 * (nr - 2) + 1);
-    fprintf(g_state_file, "255\n");
-    buildbig();
-    printf("\n");
+        case SIM_RUN:
+            left = cmd_arg;
+            break;
 
-    for (i = 0; i <= 2 * (nr - 2); i++)
-    {
-        for (j = 0; j <= 2 * (nc - 2); j++)
-        {
-            transform();
-            if (g_pq % 2 == 1)
-            {
-                if (a_pic[i1][j1] == 0)
-                {
+        case SIM_GROW:
+            left = -1;
+            radius = g_r_new + cmd_arg;
+            break;
 
-                    k = floor(63.0 * (d_dif[i1][j1] / (init_gas_rho)));
-                    fprintf(g_state_file, "%d %d %d ", g_color_off[k].red * UCHAR_MAX / USHRT_MAX, g_color_off[k].green * UCHAR_MAX / USHRT_MAX,
-                            g_color_off[k].blue * UCHAR_MAX / USHRT_MAX);
-                }
-                else
-                {
+        case SIM_STEP:
+            sim_run(1, 0);
+            sim_publish(1);
+            checkmass();
+            break;
 
-                    y = c__lm[i1][j1] + d_dif[i1][j1];
+        case SIM_SAVE:
+            t = trace_begin();
+            io_save_state();
+            io_save_snowflake();
+            trace_span("save", t);
+            break;
 
-                    k = floor((33.0 * y - alpha) / (beta - alpha));
-                    if (k > 32)
-                        k = 32;
+        case SIM_READ:
+            t = trace_begin();
+            io_read_state();
+            mass_reset();
+            dynamics_add_noise1();
+            createbdry();
+            sim_publish(1);
+            trace_span("read", t);
+            break;
 
-                    fprintf(g_state_file, "%d %d %d ", g_color_on[k].red * UCHAR_MAX / USHRT_MAX, g_color_on[k].green * UCHAR_MAX / USHRT_MAX,
-                            g_color_on[k].blue * UCHAR_MAX / USHRT_MAX);
-                }
-            }
-            else
-            {
-                if (a_pic[i1][j1] == 0)
-                {
-                    k = floor(63.0 * (d_dif[i1][j1] / (init_gas_rho)));
-                    fprintf(g_state_file, "%d %d %d ", g_color_off[k].red * UCHAR_MAX / USHRT_MAX, g_color_off[k].green * UCHAR_MAX / USHRT_MAX,
-                            g_color_off[k].blue * UCHAR_MAX / USHRT_MAX);
-                }
-                else
-                {
-                    if (c__lm[i1][j1] > 1 + 0.5 * (beta - 1.0))
-                    {
-                        if (c__lm[i1][j1] >= 1 + 0.2 * (beta - 1.0))
-                            k = 12;
-                        if (c__lm[i1][j1] >= 1 + 0.5 * (beta - 1.0))
-                            k = 13;
-                        if (c__lm[i1][j1] >= 1 + 0.7 * (beta - 1.0))
-                            k = 14;
-                        if (c__lm[i1][j1] >= beta)
-                            k = 15;
-                        fprintf(g_state_file, "%d %d %d ", g_othp[k].red * UCHAR_MAX / USHRT_MAX, g_othp[k].green * UCHAR_MAX / USHRT_MAX,
-                                g_othp[k].blue * UCHAR_MAX / USHRT_MAX);
-                    }
-                    else
-                    {
-                        k = ash[i1][j1];
-                        k = k % KAPPA_MAX;
-                        fprintf(g_state_file, "%d %d %d ", g_color[k].red * UCHAR_MAX / USHRT_MAX, g_color[k].green * UCHAR_MAX / USHRT_MAX,
-                                g_color[k].blue * UCHAR_MAX / USHRT_MAX);
-                    }
-                }
-            }
+        case SIM_QUIT:
+            return NULL;
         }
-        fprintf(g_state_file, "\n");
     }
+}
 
-    fclose(g_state_file);
-    printf(".io_save_snowflake: File written successfully.\n");
+void sim_start()
+{
+    int k;
+    pthread_attr_t attr;
+
+    for (k = 0; k < 3; k++)
+        snapshot_alloc(&g_snap[k]);
+    snapshot_take(&g_snap[0]);
+    g_snap_front = 0;
+    atomic_init(&g_snap_ready, 1);
+    g_snap_back = 2;
+    atomic_init(&g_sim_cmd_head, 0);
+    atomic_init(&g_sim_cmd_tail, 0);
+
+    // the dynamics_*() keep NR_MAX x NC_MAX arrays on the stack
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64 * 1024 * 1024);
+    pthread_create(&g_sim_thread, &attr, sim_thread, NULL);
+    pthread_attr_destroy(&attr);
+}
 
-    strcat(g_grahics_viewer_name, " ");
-    strcat(g_grahics_viewer_name, g_graphics_file_path);
-    dum = popen(g_grahics_viewer_name, "r");
+void sim_stop()
+{
+    int k;
+
+    sim_send(SIM_QUIT, 0);
+    pthread_join(g_sim_thread, NULL);
+    for (k = 0; k < 3; k++)
+        snapshot_free(&g_snap[k]);
+}
+
+/** waits at most `ms` for an X event */
+void gui_wait_event(long ms)
+{
+    fd_set fds;
+    struct timeval tv;
+    int fd;
+
+    if (XPending(g_xDisplay) > 0)
+        return;
+
+    fd = ConnectionNumber(g_xDisplay);
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    tv.tv_sec = 0;
+    tv.tv_usec = ms * 1000;
+    select(fd + 1, &fds, NULL, NULL, &tv);
 }
 
 void main(int argc, char *argv[])
@@ -1288,6 +5467,9 @@ void main(int argc, char *argv[])
     Window rw, cw;
     int rootx, rooty;
     unsigned int kgb;
+    long long t;
+
+    io_parse_args(argc, argv);
 
     /* enter data */
 
@@ -1370,6 +5552,24 @@ void main(int argc, char *argv[])
     printf("\n.main: Read params finished.\n");
     /* end data*/
 
+    if (g_bench_path[0] != '\0')
+    {
+        run_bench();
+        return;
+    }
+
+    numa_start();
+    if (g_ens_path[0] != '\0')
+    {
+        run_ensemble();
+        return;
+    }
+    if (g_headless)
+    {
+        run_headless();
+        return;
+    }
+
     g_xDisplay = XOpenDisplay("");
     g_xScreen = DefaultScreen(g_xDisplay);
     g_xWhite = XWhitePixel(g_xDisplay, g_xScreen);
@@ -1391,56 +5591,7 @@ void main(int argc, char *argv[])
 
     g_cmap = DefaultColormap(g_xDisplay, g_xScreen);
 
-    gui_braque_colors64();
-    for (i = 0; i < KAPPA_MAX; i++)
-    {
-        g_color[i].red = g_red[i] * USHRT_MAX / UCHAR_MAX;
-        g_color[i].green = g_green[i] * USHRT_MAX / UCHAR_MAX;
-        g_color[i].blue = g_blue[i] * USHRT_MAX / UCHAR_MAX;
-        XAllocColor(g_xDisplay, g_cmap, &g_color[i]);
-    }
-
-    gui_blue_colors33();
-
-    for (i = 0; i <= 32; i++)
-    {
-
-        g_color_on[i].red = g_red[i] * USHRT_MAX / UCHAR_MAX;
-        g_color_on[i].green = g_green[i] * USHRT_MAX / UCHAR_MAX;
-        g_color_on[i].blue = g_blue[i] * USHRT_MAX / UCHAR_MAX;
-        XAllocColor(g_xDisplay, g_cmap, &g_color_on[i]);
-    }
-
-    gui_off_colors64();
-
-    for (i = 0; i <= 63; i++)
-    {
-
-        g_color_off[63 - i].red = g_red[i] * USHRT_MAX / UCHAR_MAX;
-        g_color_off[63 - i].green = g_green[i] * USHRT_MAX / UCHAR_MAX;
-        g_color_off[63 - i].blue = g_blue[i] * USHRT_MAX / UCHAR_MAX;
-        XAllocColor(g_xDisplay, g_cmap, &g_color_off[63 - i]);
-    }
-
-    XAllocNamedColor(g_xDisplay, g_cmap, "orange", &g_othp[0], &g_othp[0]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "gray90", &g_othp[1], &g_othp[1]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "gray80", &g_othp[2], &g_othp[2]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "gray70", &g_othp[3], &g_othp[3]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "gray60", &g_othp[4], &g_othp[4]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "gray50", &g_othp[5], &g_othp[5]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "gray40", &g_othp[6], &g_othp[6]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "gray30", &g_othp[7], &g_othp[7]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "gray25", &g_othp[8], &g_othp[8]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "gray20", &g_othp[9], &g_othp[9]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "black", &g_othp[10], &g_othp[10]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "azure", &g_othp[11], &g_othp[11]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "lightblue2", &g_othp[12], &g_othp[12]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "lightblue3", &g_othp[13], &g_othp[13]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "lightblue4", &g_othp[14], &g_othp[14]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "cornflowerblue", &g_othp[15], &g_othp[15]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "white", &g_othp[16], &g_othp[16]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "palegreen", &g_othp[17], &g_othp[17]);
-    XAllocNamedColor(g_xDisplay, g_cmap, "red", &g_othp[18], &g_othp[18]);
+    gui_init_colors(1);
 
     g_xGC = XCreateGC(g_xDisplay, g_xWindow, 0, 0);
 
@@ -1448,6 +5599,8 @@ void main(int argc, char *argv[])
 
     XSelectInput(g_xDisplay, g_xWindow, (ButtonPressMask | ExposureMask));
 
+    gui_create_image();
+
     XMapRaised(g_xDisplay, g_xWindow);
 
     g_exit_flag = false;
@@ -1458,92 +5611,112 @@ void main(int argc, char *argv[])
 
     // ---- init state
     initialize();
-    gui_picture_big();
     /*io_print_state(); */
 
     g_pq = 0;
+    prof_start();
+    trace_start();
+    io_frames_start();
+    obs_start();
+    stop_start();
+    sim_start();
+    gui_picture_big();
 
     while (g_exit_flag == false)
     {
-        XNextEvent(g_xDisplay, &g_xEvent);
-        switch (g_xEvent.type)
+        // the picture is redrawn at the pace of the display, not per step
+        gui_wait_event(10);
+        while ((g_exit_flag == false) && (XPending(g_xDisplay) > 0))
         {
-
-        case ButtonPress:
-
-            XQueryPointer(g_xDisplay, g_xWindow, &rw, &cw, &rootx, &rooty, &posx, &posy, &kgb);
-
-            if ((posx >= 10) && (posx <= 60) && (posy >= 10) && (posy <= 30))
+            XNextEvent(g_xDisplay, &g_xEvent);
+            t = trace_begin();
+            switch (g_xEvent.type)
             {
 
-                printf("[QUIT]\n");
-                g_exit_flag = true;
-            }
-            else if ((posx >= 65) && (posx <= 115) && (posy >= 10) && (posy <= 30))
-            {
-                printf("[pause]\n");
-                if (g_pq % 2 == 0)
-                    gui_picture_rings();
-                else
-                    gui_picture_big();
-            }
-            else if ((posx >= 120) && (posx <= 170) && (posy >= 10) && (posy <= 30))
-            {
+            case ButtonPress:
 
-                printf("[play]\n");
+                XQueryPointer(g_xDisplay, g_xWindow, &rw, &cw, &rootx, &rooty, &posx, &posy, &kgb);
+                g_gui_rings = 0;
 
-                while ((XEventsQueued(g_xDisplay, QueuedAfterReading) == 0) && (g_pq != -1) && (g_stop == false))
+                if ((posx >= 10) && (posx <= 60) && (posy >= 10) && (posy <= 30))
                 {
-                    g_noac = 0;
-                    g_pq++;
-                    dynamics();
-                    if (g_pq % 10 == 0)
+
+                    printf("[QUIT]\n");
+                    g_exit_flag = true;
+                }
+                else if ((posx >= 65) && (posx <= 115) && (posy >= 10) && (posy <= 30))
+                {
+                    printf("[pause]\n");
+                    sim_send(SIM_PAUSE, 0);
+                    g_gui_rings = 1;
+                    gui_picture_shown();
+                }
+                else if ((posx >= 120) && (posx <= 170) && (posy >= 10) && (posy <= 30))
+                {
+                    printf("[play]\n");
+                    sim_send(SIM_PLAY, 0);
+                }
+                else if ((posx >= 175) && (posx <= 225) && (posy >= 10) && (posy <= 30))
+                {
+                    printf("[save] to file\n");
+                    sim_send(SIM_SAVE, 0);
+                }
+                else if ((posx >= 230) && (posx <= 280) && (posy >= 10) && (posy <= 30))
+                {
+                    printf("[read] from file\n");
+                    sim_send(SIM_READ, 0);
+                }
+                else if ((posx >= 120) && (posx <= 335) && ((posx - 120) % 55 <= 50) && (posy >= 32) && (posy <= 48))
+                {
+                    k = (posx - 120) / 55;
+                    if (k < 3)
+                    {
+                        printf("[+%d] steps\n", k == 0 ? 10 : k == 1 ? 100 : 1000);
+                        sim_send(SIM_RUN, k == 0 ? 10 : k == 1 ? 100 : 1000);
+                    }
+                    else
                     {
-                        gui_picture_big();
+                        printf("[r+10] radius\n");
+                        sim_send(SIM_GROW, 10);
                     }
                 }
-            }
-            else if ((posx >= 175) && (posx <= 225) && (posy >= 10) && (posy <= 30))
-            {
-                printf("[save] to file\n");
-                io_save_state();
-                io_save_snowflake();
-            }
-
-            else if ((posx >= 230) && (posx <= 280) && (posy >= 10) && (posy <= 30))
-            {
+                else
+                {
+                    printf("[step]\n");
+                    sim_send(SIM_STEP, 0);
+                }
 
-                printf("[read] from file\n");
-                io_read_state();
-                dynamics_add_noise1();
-                createbdry();
-                gui_picture_big();
-            }
+                break;
 
-            else
-            {
-                printf("[step]\n");
+            case Expose:
 
-                g_noac = 0;
-                g_pq++;
-                dynamics();
-                gui_picture_big();
-                checkmass();
+                if (g_xEvent.xexpose.count == 0)
+                {
+                    g_gui_full = 1;
+                    gui_picture_shown();
+                    gui_draw_buttons();
+                }
+                break;
             }
+            trace_span((g_xEvent.type == ButtonPress) ? "button" : "expose", t);
+        }
 
-            break;
-
-        case Expose:
-
-            if (g_xEvent.xexpose.count == 0)
-            {
-                gui_picture_big();
-                gui_draw_buttons();
-            }
-            break;
+        if (gui_take_snapshot())
+        {
+            t = trace_begin();
+            gui_picture_shown();
+            trace_span("picture", t);
         }
+        trace_check();
     }
 
+    sim_stop();
+    io_frames_finish();
+    prof_finish();
+    trace_finish();
+    obs_finish();
+
+    gui_destroy_image();
     XFreeGC(g_xDisplay, g_xGC);
     XDestroyWindow(g_xDisplay, g_xWindow);
     XCloseDisplay(g_xDisplay);
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Runs the parameter files of the benchmark corpus headless, each to a
+# fixed number of steps or the stop criterion, and prints one line per
+# file: steps, why it stopped, wall time, steps/s, peak RSS and the
+# checksum of the final state.
+#
+# usage: tools/bench-corpus.sh [FSNOW [STEPS [FILES...]]]
+#        (default: ./fsnow, 30000, examples/h2l-4.txt examples/bench/*.txt)
+#
+# The runs use a fixed seed, so the checksums of a file only change when
+# the dynamics do.
+
+fsnow=${1:-./fsnow}
+steps=${2:-30000}
+[ $# -gt 2 ] && shift 2 || set -- examples/h2l-4.txt examples/bench/*.txt
+
+case $fsnow in
+/*) ;;
+*) fsnow=$(pwd)/$fsnow ;;
+esac
+
+# the runs write their state and picture, keep them out of the tree
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+printf "%-24s %8s %13s %10s %10s %8s %16s\n" file steps stop seconds steps/s rss_kb checksum
+for f in "$@"; do
+    case $f in
+    /*) in=$f ;;
+    *) in=$(pwd)/$f ;;
+    esac
+    line=$(cd "$dir" && "$fsnow" -headless -seed 1 -steps "$steps" < "$in" | grep '^\.run_headless: summary')
+    if [ -z "$line" ]; then
+        printf "%-24s failed\n" "$(basename "$f")"
+        continue
+    fi
+    set -- $line
+    printf "%-24s %8s %13s %10s %10s %8s %16s\n" "$(basename "$f")" $4 $6 $8 ${10} ${12} ${14}
+done
@@ -0,0 +1,66 @@
+#!/bin/sh
+# Runs an -ensemble sweep repeatedly with several thread counts and checks
+# every set against a -headless run of it, to catch races between the
+# threads that take sets and bands from each other. Use a host with more
+# CPUs than the largest thread count so the threads really run at once.
+#
+# usage: tools/ensemble-stress.sh FSNOW [ROUNDS [STEPS [PARAMS [SETS [THREADS...]]]]]
+#        (defaults: 20, 300, examples/bench/dendrite.txt, examples/sweep.txt,
+#        threads 2 4 8 16)
+#
+# The exit status is the number of runs in which a set differed.
+
+fsnow=$1
+rounds=${2:-20}
+steps=${3:-300}
+params=${4:-examples/bench/dendrite.txt}
+sets=${5:-examples/sweep.txt}
+if [ $# -gt 5 ]; then shift 5; else set -- 2 4 8 16; fi
+
+if [ -z "$fsnow" ]; then
+    echo "usage: $0 FSNOW [ROUNDS [STEPS [PARAMS [SETS [THREADS...]]]]]" >&2
+    exit 2
+fi
+case $fsnow in
+/*) ;;
+*) fsnow=$(pwd)/$fsnow ;;
+esac
+params=$(cd "$(dirname "$params")" && pwd)/$(basename "$params")
+sets=$(cd "$(dirname "$sets")" && pwd)/$(basename "$sets")
+
+# the runs write their state and picture, keep them out of the tree
+tmp=$(mktemp -d) || exit 2
+trap 'rm -rf "$tmp"' EXIT
+cd "$tmp" || exit 2
+
+# the checksum of each set from -headless, one line "N CHECKSUM"
+n=0
+grep '^[0-9.]' "$sets" | while read -r beta alpha theta kappa mu gamma; do
+    n=$((n + 1))
+    sed -e "s/^beta:.*/beta:$beta/" -e "s/^alpha:.*/alpha:$alpha/" -e "s/^theta:.*/theta:$theta/" \
+        -e "s/^kappa:.*/kappa:$kappa/" -e "s/^mu:.*/mu:$mu/" -e "s/^gamma:.*/gamma:$gamma/" "$params" > set.txt
+    echo "$n $("$fsnow" -headless -seed 1 -steps "$steps" < set.txt | sed -n 's/.*summary.* checksum //p')"
+done > headless.txt
+if [ ! -s headless.txt ] || grep -q ' $' headless.txt; then
+    echo "$0: no checksums from $fsnow -headless" >&2
+    exit 2
+fi
+echo "$(wc -l < headless.txt) sets, $steps steps, $rounds rounds, threads $*, $(nproc) CPUs"
+
+failed=0
+for w in "$@"; do
+    bad=0
+    r=0
+    while [ $r -lt "$rounds" ]; do
+        r=$((r + 1))
+        "$fsnow" -ensemble "$sets" -ensemble-threads "$w" -ensemble-progress 0 -seed 1 -steps "$steps" < "$params" |
+            sed -n 's/^\.run_ensemble: set \([0-9]*\) .* checksum \([0-9a-f]*\)$/\1 \2/p' | sort -n > ensemble.txt
+        if ! cmp -s headless.txt ensemble.txt; then
+            bad=$((bad + 1))
+            diff headless.txt ensemble.txt | sed "s/^/threads $w round $r: /"
+        fi
+    done
+    printf "threads %-3s %d of %d rounds differ\n" "$w" "$bad" "$rounds"
+    failed=$((failed + bad))
+done
+exit $failed
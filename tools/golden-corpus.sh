@@ -0,0 +1,47 @@
+#!/bin/sh
+# Records golden trajectories of the benchmark corpus with a reference
+# build, or checks another build against them.
+#
+# usage: tools/golden-corpus.sh record|check FSNOW DIR [STEPS [-golden-tol T]]
+#        (STEPS default 2000; files: examples/h2l-4.txt examples/bench/*.txt)
+#
+# DIR holds one NAME.golden per parameter file. The exit status is the
+# number of files that do not match.
+
+mode=$1
+fsnow=$2
+dir=$3
+steps=${4:-2000}
+if [ $# -ge 4 ]; then shift 4; else shift $#; fi
+
+case $mode in
+record | check) ;;
+*)
+    echo "usage: $0 record|check FSNOW DIR [STEPS [-golden-tol T]]" >&2
+    exit 2
+    ;;
+esac
+
+case $fsnow in
+/*) ;;
+*) fsnow=$(pwd)/$fsnow ;;
+esac
+mkdir -p "$dir" || exit 2
+dir=$(cd "$dir" && pwd)
+
+# the runs write their state and picture, keep them out of the tree
+tmp=$(mktemp -d) || exit 2
+trap 'rm -rf "$tmp"' EXIT
+
+failed=0
+for f in examples/h2l-4.txt examples/bench/*.txt; do
+    name=$(basename "$f" .txt)
+    in=$(pwd)/$f
+    out=$(cd "$tmp" && "$fsnow" -golden-$mode "$dir/$name.golden" -seed 1 -steps "$steps" "$@" < "$in")
+    status=$?
+    printf "%-12s " "$name"
+    echo "$out" | grep '^\.golden' | tr '\n' ' '
+    echo
+    [ "$mode" = check ] && [ $status -ne 0 ] && failed=$((failed + 1))
+done
+exit $failed